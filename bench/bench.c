@@ -0,0 +1,140 @@
+/* bench: measures the clog hot path so changes to _clog_log and the
+ * formatter can be judged in numbers instead of gut feeling.
+ *
+ * Reported per configuration (see the Makefile for the built variants):
+ *  - cost of a LOG_D whose module level suppresses it (avg ns/call);
+ *  - single-threaded latency of a formatted message into a do-nothing
+ *    console sink (p50/p99 over individual samples);
+ *  - file-sink throughput in msgs/sec.
+ *
+ * Per-sample latencies include the clock_gettime overhead; the measured
+ * timer overhead is printed so it can be subtracted mentally.
+ *
+ * Build and run:  make run
+ */
+
+#define CLOG_MAIN
+#define CLOG_FILE_SUPPORT
+#include "clog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+clog_create_module(BENCH, LEVEL_DEBUG);
+
+#define SUPPRESSED_ITERS 50000000
+#define LATENCY_SAMPLES  200000
+#define THROUGHPUT_MSGS  500000
+
+/* Keeps the compiler from hoisting the level check out of the measurement
+ * loops or deleting them outright. */
+#define BARRIER() __asm__ __volatile__("" ::: "memory")
+
+static unsigned long long ns_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull +
+    (unsigned long long)ts.tv_nsec;
+}
+
+static int null_out(const char* fmt, ...)
+{
+  (void)fmt;
+  return 0;
+}
+
+static int cmp_ull(const void* a, const void* b)
+{
+  unsigned long long x = *(const unsigned long long*)a;
+  unsigned long long y = *(const unsigned long long*)b;
+  return x < y ? -1 : x > y;
+}
+
+static unsigned long long timer_overhead(void)
+{
+  unsigned long long samples[1001];
+  int i;
+
+  for (i = 0; i < 1001; ++i) {
+    samples[i] = ns_now();
+  }
+  for (i = 0; i < 1000; ++i) {
+    samples[i] = samples[i + 1] - samples[i];
+  }
+  qsort(samples, 1000, sizeof(samples[0]), cmp_ull);
+  return samples[500];
+}
+
+static void bench_suppressed(void)
+{
+  unsigned long long t0, t1;
+  int i;
+
+  clog_set_module_level("BENCH", LEVEL_ERROR);
+  t0 = ns_now();
+  for (i = 0; i < SUPPRESSED_ITERS; ++i) {
+    LOG_D(BENCH, "suppressed %d", i);
+    BARRIER();
+  }
+  t1 = ns_now();
+  clog_set_module_level("BENCH", LEVEL_DEBUG);
+  printf("suppressed LOG_D:    %7.2f ns/call  (avg over %d calls)\n",
+    (double)(t1 - t0) / SUPPRESSED_ITERS, SUPPRESSED_ITERS);
+}
+
+static void bench_latency(void)
+{
+  static unsigned long long samples[LATENCY_SAMPLES];
+  unsigned long long t0;
+  int i;
+
+  clog_init_console(null_out);
+  for (i = 0; i < LATENCY_SAMPLES; ++i) {
+    t0 = ns_now();
+    LOG_I(BENCH, "latency sample %d of %d", i, LATENCY_SAMPLES);
+    samples[i] = ns_now() - t0;
+    BARRIER();
+  }
+  qsort(samples, LATENCY_SAMPLES, sizeof(samples[0]), cmp_ull);
+  printf("formatted message:   p50=%llu ns  p99=%llu ns"
+    "  (%d samples, null sink, timer overhead ~%llu ns)\n",
+    samples[LATENCY_SAMPLES / 2], samples[LATENCY_SAMPLES / 100 * 99],
+    LATENCY_SAMPLES, timer_overhead());
+}
+
+static void bench_file_throughput(void)
+{
+  unsigned long long t0, t1;
+  double secs;
+  int i;
+
+  if (clog_init_file("bench.log")) {
+    fprintf(stderr, "cannot open bench.log, skipping file benchmark\n");
+    return;
+  }
+  t0 = ns_now();
+  for (i = 0; i < THROUGHPUT_MSGS; ++i) {
+    LOG_I(BENCH, "throughput message %d of %d", i, THROUGHPUT_MSGS);
+  }
+  t1 = ns_now();
+  clog_close_file();
+  remove("bench.log");
+  secs = (double)(t1 - t0) / 1e9;
+  printf("file sink:           %7.0f kmsgs/sec  (%d msgs in %.2f s)\n",
+    THROUGHPUT_MSGS / secs / 1000.0, THROUGHPUT_MSGS, secs);
+}
+
+int main(void)
+{
+#ifdef CLOG_TIME_SUPPORT
+  printf("clog bench (CLOG_TIME_SUPPORT on)\n");
+#else
+  printf("clog bench (CLOG_TIME_SUPPORT off)\n");
+#endif
+  bench_suppressed();
+  bench_latency();
+  bench_file_throughput();
+  return 0;
+}
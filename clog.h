@@ -44,7 +44,75 @@
  * #define CLOG_DISABLED added before #include "clog.h" or globally will exclude logger's macros from compillation
  * #define CLOG_TIME_SUPPORT added before #include "clog.h"  or globally will turn on timestamp support
  * #define CLOG_FILE_SUPPORT added before #include "clog.h"  or globally will turn on log file support
- * 
+ * #define CLOG_COMPILE_LEVEL to one of CLOG_LEVEL_DEBUG..CLOG_LEVEL_NONE (numeric 0..4)
+ * before #include "clog.h" or globally removes all LOG_* sites below that level at
+ * compile time: the macros expand to nothing, so the format strings and __FILE__
+ * literals of those sites do not even land in .rodata. Defaults to CLOG_LEVEL_DEBUG
+ * (keep everything).
+ * #define CLOG_THREAD_SAFE added before #include "clog.h" or globally makes concurrent LOG_*
+ * calls safe: each message goes out in a single write so lines do not interleave,
+ * scratch and timestamp-cache buffers become thread-local, runtime level changes use
+ * atomics, and only the buffered file sink takes a (short) lock. Requires pthreads
+ * and GCC/Clang atomics (or MSVC for the thread-local part).
+ * #define CLOG_ASYNC added before #include "clog.h" or globally will turn on asynchronous logging:
+ * LOG_* calls only capture the message into a lock-free ring buffer and a background
+ * thread performs the formatting and output. Call clog_flush() before exiting to make
+ * sure all queued messages have been written. Requires pthreads and GCC/Clang atomics.
+ * #define CLOG_WRITEV_SUPPORT added before #include "clog.h" or globally makes the plain
+ * file sink emit each message with a single writev directly from the compiled format
+ * tokens - literal spans, the cached timestamp, the module/level strings and the
+ * message body are passed as an iovec array, skipping the intermediate assembly of
+ * the line into one contiguous buffer. Requires CLOG_FILE_SUPPORT and POSIX writev.
+ * #define CLOG_MMAP_SUPPORT added before #include "clog.h" or globally enables the
+ * memory-mapped file sink: clog_init_file_mmap(path, initial_size) preallocates the
+ * log file and appends by memcpy into the mapping, so the steady state issues no
+ * write syscalls and the kernel writes pages back lazily. Requires CLOG_FILE_SUPPORT
+ * and a POSIX mmap.
+ * #define CLOG_BINARY added before #include "clog.h" or globally makes the LOG_* macros
+ * write compact binary records to the log file instead of text: each call site
+ * (file, line, format string) is registered once under a small ID and every message
+ * stores just that ID plus the raw argument values, deferring all formatting to the
+ * offline decoder in tools/clog_decode.c. Requires CLOG_FILE_SUPPORT; decode on a
+ * host with the same endianness.
+ * #define CLOG_RING_SUPPORT added before #include "clog.h" or globally enables the
+ * in-memory flight recorder: after clog_init_ring() every accepted message is
+ * captured into a preallocated circular RAM buffer (site pointers, timestamp and
+ * the printf-expanded body - no line formatting, no I/O) and the configured sink
+ * is bypassed. clog_dump_ring(fd) formats and writes the retained messages,
+ * oldest first - typically called from a crash handler to get full debug
+ * verbosity for the moments before the crash at RAM-copy cost per message.
+ * #define CLOG_MULTI_SINK added before #include "clog.h" or globally enables the
+ * sink array: clog_add_sink_fd() / clog_add_sink_file() / clog_add_sink_console()
+ * register up to CLOG_MAX_SINKS additional destinations, each with its own
+ * minimum level and its own output buffer with a flush cadence, so e.g. WARN+
+ * can go to the console unbuffered while everything is batched into a file and
+ * errors go straight to a socket fd. The message is formatted once and fanned
+ * out to every sink whose minimum level admits it.
+ * #define CLOG_SOCKET_SUPPORT added before #include "clog.h" or globally enables the
+ * datagram sink: clog_init_socket(host, port) resolves the collector, connects a
+ * UDP socket and ships one formatted message per datagram with strictly
+ * non-blocking sends - a slow or dead collector can never backpressure the
+ * application, messages that cannot be sent are dropped and counted
+ * (clog_socket_dropped()). Requires POSIX sockets.
+ * #define CLOG_DIRECT_SUPPORT added before #include "clog.h" or globally enables the
+ * direct-I/O sink and the durability policy: clog_init_file_direct(path,
+ * block_bytes, bufblocks) stages messages in an aligned buffer and writes whole
+ * aligned blocks with pwrite on an O_DIRECT descriptor, bypassing the page cache
+ * so kernel writeback cannot stall log calls; clog_set_sync_policy(bytes, ms,
+ * on_error) adds an fdatasync cadence (every N bytes / every M milliseconds / on
+ * error-level messages) to any file sink. Requires CLOG_FILE_SUPPORT; on
+ * filesystems or platforms without O_DIRECT the sink falls back to a normal
+ * descriptor and keeps the aligned staging discipline. Compile with _GNU_SOURCE
+ * on Linux so fcntl.h exposes O_DIRECT.
+ * #define CLOG_COMPRESS_SUPPORT added before #include "clog.h" or globally enables the
+ * compressed file sink: clog_init_file_compressed(path) batches formatted messages
+ * into CLOG_COMPRESS_BLOCK-byte chunks and writes each one as an independent block
+ * of a standard LZ4 frame (the file is readable with the stock lz4 tool). Log text
+ * typically compresses around 10x, trading a little CPU for an order of magnitude
+ * less disk bandwidth. A block also goes out when CLOG_COMPRESS_FLUSH_MS elapses
+ * or on an error-level message; call clog_close_file() to finalize the frame.
+ * Requires CLOG_FILE_SUPPORT.
+ *
  * Examples:
  *
  *
@@ -145,14 +213,75 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if defined(CLOG_ASYNC) || defined(CLOG_THREAD_SAFE)
+#include <pthread.h>
+#endif
+
+#ifdef CLOG_MMAP_SUPPORT
+#ifndef CLOG_FILE_SUPPORT
+#error "CLOG_MMAP_SUPPORT requires CLOG_FILE_SUPPORT"
+#endif
+#include <sys/mman.h>
+#endif
+
+#ifdef CLOG_WRITEV_SUPPORT
+#ifndef CLOG_FILE_SUPPORT
+#error "CLOG_WRITEV_SUPPORT requires CLOG_FILE_SUPPORT"
+#endif
+#include <sys/uio.h>
+#endif
+
+#ifdef CLOG_SOCKET_SUPPORT
+#ifdef _WIN32
+#error "CLOG_SOCKET_SUPPORT requires POSIX sockets"
+#endif
+#include <sys/socket.h>
+#include <netdb.h>
+#endif
+
+#ifdef CLOG_DIRECT_SUPPORT
+#ifndef CLOG_FILE_SUPPORT
+#error "CLOG_DIRECT_SUPPORT requires CLOG_FILE_SUPPORT"
+#endif
+#ifdef _WIN32
+#error "CLOG_DIRECT_SUPPORT requires POSIX file I/O"
+#endif
+#endif
+
+#ifdef CLOG_COMPRESS_SUPPORT
+#ifndef CLOG_FILE_SUPPORT
+#error "CLOG_COMPRESS_SUPPORT requires CLOG_FILE_SUPPORT"
+#endif
+#endif
+
+#if defined(CLOG_RING_SUPPORT) && defined(CLOG_BINARY)
+/* Both modes defer formatting, each with its own capture path; pick one. */
+#error "CLOG_RING_SUPPORT cannot be combined with CLOG_BINARY"
+#endif
 
 /* Format strings cannot be longer than this. */
 #define CLOG_FORMAT_LENGTH 256
 
+/* Maximum number of tokens a compiled format string can produce. */
+#define CLOG_FORMAT_TOKENS 64
+
+/* Maximum number of modules the registry can hold. */
+#ifndef CLOG_MAX_MODULES
+#define CLOG_MAX_MODULES 128
+#endif
+
+/* Log file paths kept by the rotating sink cannot be longer than this. */
+#define CLOG_PATH_LENGTH 256
+
 /* Formatted times and dates should be less than this length. If they are not,
  * they will not appear in the log. */
 #define CLOG_DATETIME_LENGTH 256
@@ -182,24 +311,58 @@
 /* Default console output funciton */
 #define CLOG_DEFAULT_MESSAGE_FUNCTION printf
 
+/* The log levels as plain numbers, usable in preprocessor conditionals. */
+#define CLOG_LEVEL_DEBUG 0
+#define CLOG_LEVEL_INFO  1
+#define CLOG_LEVEL_WARN  2
+#define CLOG_LEVEL_ERROR 3
+#define CLOG_LEVEL_NONE  4
+
+/* Log sites below this level are removed at compile time: their macros
+ * expand to nothing, so neither the call nor the format-string and __FILE__
+ * literals survive into the binary. */
+#ifndef CLOG_COMPILE_LEVEL
+#define CLOG_COMPILE_LEVEL CLOG_LEVEL_DEBUG
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
   enum clog_level {
-    LEVEL_DEBUG,
-    LEVEL_INFO,
-    LEVEL_WARN,
-    LEVEL_ERROR,
-    LEVEL_NONE
+    LEVEL_DEBUG = CLOG_LEVEL_DEBUG,
+    LEVEL_INFO = CLOG_LEVEL_INFO,
+    LEVEL_WARN = CLOG_LEVEL_WARN,
+    LEVEL_ERROR = CLOG_LEVEL_ERROR,
+    LEVEL_NONE = CLOG_LEVEL_NONE
   };
 
   typedef struct
   {
     const char* module_name;
     enum clog_level module_level;
+
+    /* Self-instrumentation counters, updated with relaxed atomics under
+     * CLOG_THREAD_SAFE (plain increments otherwise) so reading them is
+     * approximate but the hot path pays single cycles.  See
+     * clog_get_stats() and clog_log_stats(). */
+    unsigned long emitted;      /* Messages accepted by the level check. */
+    unsigned long suppressed;   /* Messages rejected by the level check. */
+    unsigned long dropped;      /* Messages lost at a sink (ring full,
+                                   socket would block). */
+    unsigned long bytes;        /* Formatted bytes handed to sinks. */
+    unsigned long flush_stalls; /* Times a message had to flush a full
+                                   output buffer synchronously. */
   } clog_control_block_t;
 
+  /* Per-site state for the rate-limited LOG_*_RL macros. */
+  typedef struct
+  {
+    long window_ms;           /* Start of the current one-second window. */
+    unsigned int count;       /* Messages accepted in this window. */
+    unsigned long suppressed; /* Messages dropped since the last summary. */
+  } clog_ratelimit_t;
+
   struct clog;
 
   /**
@@ -215,6 +378,178 @@ extern "C" {
    */
   int clog_init_file(const char* const path);
 
+  /**
+   * Like clog_init_file(), but coalesces messages into an internal buffer and
+   * writes them out in batches instead of issuing one write per message.  The
+   * buffer is flushed when it fills up, when flush_interval_ms milliseconds
+   * have passed since the last flush, on error-level messages (so crash logs
+   * are not lost), on clog_flush() and on clog_close_file().
+   *
+   *
+   * @param path
+   * Path to the file where log messages will be written.
+   *
+   * @param bufsize
+   * Size of the output buffer in bytes.
+   *
+   * @param flush_interval_ms
+   * Maximum age of a buffered message before it is forced out.  Pass zero to
+   * flush on buffer-full only.
+   *
+   * @return
+   * Zero on success, non-zero on failure.
+   */
+  int clog_init_file_buffered(const char* const path, size_t bufsize,
+      long flush_interval_ms);
+
+  /**
+   * Like clog_init_file_buffered(), but safe for several processes appending
+   * to the same file: every flush is broken into write() calls of at most
+   * CLOG_SHARED_CHUNK bytes, each cut at a line boundary, issued on the
+   * shared O_APPEND descriptor.  Each such write lands contiguously at the
+   * end of the file, so concurrent workers interleave whole groups of lines
+   * instead of corrupting each other mid-line, and the per-process buffering
+   * keeps the contention on the shared inode down to one syscall per batch.
+   * A single line longer than the chunk goes out in one oversized write
+   * rather than split.  Do not combine with rotation: the renames would race
+   * between processes.
+   *
+   *
+   * @param path
+   * Path to the file shared by all processes.
+   *
+   * @param bufsize
+   * Size of this process's staging buffer in bytes.
+   *
+   * @param flush_interval_ms
+   * Maximum age of a buffered message before it is forced out.  Pass zero to
+   * flush on buffer-full only.
+   *
+   * @return
+   * Zero on success, non-zero on failure.
+   */
+  int clog_init_file_shared(const char* const path, size_t bufsize,
+      long flush_interval_ms);
+
+  /**
+   * Like clog_init_file(), but maps the log file into memory and appends by
+   * memcpy into the mapping (requires CLOG_MMAP_SUPPORT).  The file is
+   * preallocated to initial_size bytes and grown (doubling) when the region
+   * fills; no write syscalls happen in the steady state, the kernel writes
+   * the pages back lazily.  clog_flush() runs msync; clog_close_file() trims
+   * the preallocated tail back to the real length.
+   *
+   *
+   * @param path
+   * Path to the file where log messages will be written.
+   *
+   * @param initial_size
+   * Number of bytes to preallocate up front.
+   *
+   * @return
+   * Zero on success, non-zero on failure.
+   */
+  int clog_init_file_mmap(const char* const path, size_t initial_size);
+
+  /**
+   * Like clog_init_file(), but rotates the log when it grows past max_bytes:
+   * path is renamed to path.1, path.1 to path.2 and so on, keeping at most
+   * max_files files in total, and logging continues into a fresh file at
+   * path.  The new fd is swapped in right after the rename, so rotation
+   * costs one flush, the renames and one open - no logging downtime.
+   *
+   *
+   * @param path
+   * Path to the file where log messages will be written; must be shorter
+   * than CLOG_PATH_LENGTH.
+   *
+   * @param max_bytes
+   * Size threshold at which the file is rotated.
+   *
+   * @param max_files
+   * Total number of files to keep, including the active one.
+   *
+   * @return
+   * Zero on success, non-zero on failure.
+   */
+  int clog_init_file_rotating(const char* const path, size_t max_bytes,
+      int max_files);
+
+#ifdef CLOG_DIRECT_SUPPORT
+  /**
+   * Like clog_init_file(), but bypasses the page cache (requires
+   * CLOG_DIRECT_SUPPORT): the file is opened with O_DIRECT and messages are
+   * staged in an aligned buffer from which only whole aligned blocks are
+   * written, so periodic kernel writeback cannot stall log calls on hosts
+   * where the page cache belongs to somebody else (databases).  The
+   * partially filled tail block is written out padded with zeros by
+   * clog_flush() and rewritten in place as it fills; clog_close_file()
+   * trims the padding.  On filesystems that reject O_DIRECT the sink falls
+   * back to a normal descriptor and keeps the staging discipline.
+   * Durability is controlled separately via clog_set_sync_policy().
+   *
+   *
+   * @param path
+   * Path to the file where log messages will be written.
+   *
+   * @param block_bytes
+   * Write granularity; a power of two and at least 512, matching the
+   * device's logical block size (or a multiple of it).
+   *
+   * @param bufblocks
+   * Number of blocks the staging buffer holds.
+   *
+   * @return
+   * Zero on success, non-zero on failure.
+   */
+  int clog_init_file_direct(const char* const path, size_t block_bytes,
+      size_t bufblocks);
+
+  /**
+   * Set the fdatasync cadence of the file sink (requires
+   * CLOG_DIRECT_SUPPORT), choosing between throughput and durability per
+   * deployment instead of inheriting whatever the page cache does.  After
+   * a message is written, fdatasync runs when any enabled condition holds;
+   * passing all zeros (the default) never syncs explicitly.
+   *
+   *
+   * @param every_bytes
+   * Sync once at least this many bytes were produced since the last sync;
+   * zero disables the byte trigger.
+   *
+   * @param every_ms
+   * Sync once this many milliseconds passed since the last sync; zero
+   * disables the time trigger.
+   *
+   * @param on_error
+   * Non-zero syncs after every error-level message.
+   */
+  void clog_set_sync_policy(size_t every_bytes, long every_ms, int on_error);
+#endif /* CLOG_DIRECT_SUPPORT */
+
+#ifdef CLOG_COMPRESS_SUPPORT
+  /**
+   * Like clog_init_file(), but compresses the output (requires
+   * CLOG_COMPRESS_SUPPORT): formatted messages are batched into a
+   * CLOG_COMPRESS_BLOCK-byte staging buffer and each full batch goes out
+   * as one independent block of a standard LZ4 frame, so the file can be
+   * read back with the stock lz4 tool (lz4 -d).  Log text typically
+   * compresses around 10x, which matters when disk bandwidth and retention
+   * cost more than the compressor's few percent of CPU.  A partial batch
+   * is also flushed when CLOG_COMPRESS_FLUSH_MS elapses, on an error-level
+   * message and by clog_flush(); clog_close_file() writes the frame's end
+   * mark, so always close before reading the file back.
+   *
+   *
+   * @param path
+   * Path to the file where the compressed log will be written.
+   *
+   * @return
+   * Zero on success, non-zero on failure.
+   */
+  int clog_init_file_compressed(const char* const path);
+#endif /* CLOG_COMPRESS_SUPPORT */
+
   /**
    * Closes the logger file.  You should do this at the end of execution,
    * or when you are done using the logger.
@@ -222,18 +557,327 @@ extern "C" {
    */
   void clog_close_file(void);
 
+  /**
+   * Flushes any messages the logger is still holding on to.  With CLOG_ASYNC
+   * this waits until the background thread has drained the ring buffer and
+   * written every queued message; call it before process exit.  With a
+   * buffered file sink (clog_init_file_buffered) it writes out the output
+   * buffer, and with CLOG_MULTI_SINK it also flushes every sink buffer.
+   *
+   */
+  void clog_flush(void);
+
   /**
    * Set a custom console output function.
    *
    *
    * @param fun
-   * Function pointer for printing the message.
+   * Function pointer for printing the message.  With CLOG_MULTI_SINK a
+   * NULL pointer is accepted and silences the regular sink, leaving the
+   * sink array as the only destination.
    *
    * @return
    * Zero on success, non-zero on failure.
    */
   int clog_init_console(int (*fun)(const char* format, ...));
 
+  /**
+   * Set the log format.  The format is compiled once, into an array of
+   * {literal-span, specifier} tokens stored in the logger, so the
+   * per-message path is a tight loop over precomputed segments instead of a
+   * character-by-character re-parse.  See the specifier table above
+   * CLOG_DEFAULT_FORMAT for the supported specifiers.
+   *
+   *
+   * @param fmt
+   * The new format string; must be shorter than CLOG_FORMAT_LENGTH.
+   *
+   * @return
+   * Zero on success, non-zero on failure (format too long or too complex).
+   */
+  int clog_set_format(const char* fmt);
+
+  /**
+   * Change the level of a module at runtime, e.g. to flip a module to
+   * LEVEL_DEBUG on a live system and back.  Modules register themselves in a
+   * registry when the executable starts (GCC/Clang constructor attribute);
+   * the per-message level check stays a single load from the module's
+   * control block, no lookup is involved.
+   *
+   *
+   * @param name
+   * The module name as given to clog_create_module().
+   *
+   * @param level
+   * The new message level.
+   *
+   * @return
+   * Zero on success, non-zero if no such module is registered.
+   */
+  int clog_set_module_level(const char* name, enum clog_level level);
+
+  /**
+   * Change the level of every registered module at once.
+   *
+   *
+   * @param level
+   * The new message level.
+   */
+  void clog_set_all_levels(enum clog_level level);
+
+  /**
+   * Change the level of a whole module group.  A pattern ending in '*'
+   * matches every registered module whose name starts with the characters
+   * before the star, so with dotted module names (see
+   * clog_create_module_named()) clog_set_level("NET.*", LEVEL_DEBUG) flips
+   * NET.TCP, NET.HTTP and so on in one call; any other pattern behaves
+   * like clog_set_module_level().  The sweep walks the contiguous registry
+   * array, not the modules' translation units.
+   *
+   *
+   * @param pattern
+   * A module name, or a name prefix followed by '*'.
+   *
+   * @param level
+   * The new message level.
+   *
+   * @return
+   * Zero if at least one module matched, non-zero otherwise.
+   */
+  int clog_set_level(const char* pattern, enum clog_level level);
+
+  /**
+   * Look up a module's control block to read its self-instrumentation
+   * counters: messages emitted and suppressed by the level check, messages
+   * dropped at a sink, formatted bytes produced, and synchronous flushes
+   * forced by a full output buffer.  Counting is always on; the counters
+   * are relaxed-atomic under CLOG_THREAD_SAFE, so values read while other
+   * threads log are approximate.
+   *
+   *
+   * @param name
+   * The module name as given to clog_create_module().
+   *
+   * @return
+   * The module's control block, or NULL if no such module is registered.
+   */
+  const clog_control_block_t* clog_get_stats(const char* name);
+
+  /**
+   * Emit one self-report line per module that has seen any traffic, e.g.
+   *
+   *   I: CLOG: NET.TCP: emitted=5021 suppressed=120340 dropped=3
+   *   bytes=401680 flush_stalls=2
+   *
+   * through the configured sink, under the internal module name "CLOG".
+   * Call it periodically (or at exit) to see what logging itself costs.
+   *
+   */
+  void clog_log_stats(void);
+
+  /**
+   * Render an unsigned 64-bit value as decimal digits, two digits per step
+   * through a lookup table instead of snprintf's generic format machinery.
+   * This is what the logger itself uses for %n line numbers and the %h tick
+   * value; it is exposed so hot call sites can pre-render numbers into
+   * message bodies with %s.
+   *
+   *
+   * @param dst
+   * Destination buffer of at least 21 bytes (20 digits plus terminator).
+   *
+   * @param v
+   * The value to render.
+   *
+   * @return
+   * The number of characters written, excluding the terminator.
+   */
+  size_t clog_fmt_u64(char* dst, unsigned long long v);
+
+  /**
+   * Render an unsigned 64-bit value as lowercase hex digits, without a
+   * 0x prefix or leading zeros.
+   *
+   *
+   * @param dst
+   * Destination buffer of at least 17 bytes (16 digits plus terminator).
+   *
+   * @param v
+   * The value to render.
+   *
+   * @return
+   * The number of characters written, excluding the terminator.
+   */
+  size_t clog_fmt_hex(char* dst, unsigned long long v);
+
+#ifdef CLOG_SOCKET_SUPPORT
+  /**
+   * Ship log messages to a collector over UDP (requires
+   * CLOG_SOCKET_SUPPORT).  The socket is connected and switched to
+   * non-blocking mode; every formatted message goes out as one datagram.
+   * A send that would block or fails for any other reason never stalls the
+   * caller: the message is dropped and counted instead, see
+   * clog_socket_dropped().  Like the other init functions this replaces
+   * the current sink.
+   *
+   *
+   * @param host
+   * Hostname or address of the collector.
+   *
+   * @param port
+   * UDP port the collector listens on.
+   *
+   * @return
+   * Zero on success, non-zero when the host cannot be resolved or the
+   * socket cannot be created.
+   */
+  int clog_init_socket(const char* host, int port);
+
+  /**
+   * Closes the datagram sink opened by clog_init_socket().
+   *
+   */
+  void clog_close_socket(void);
+
+  /**
+   * Number of messages dropped by the datagram sink so far because a
+   * non-blocking send could not complete.
+   *
+   *
+   * @return
+   * The drop count since clog_init_socket().
+   */
+  unsigned long clog_socket_dropped(void);
+#endif /* CLOG_SOCKET_SUPPORT */
+
+#ifdef CLOG_RING_SUPPORT
+  /**
+   * Arm the in-memory flight recorder (requires CLOG_RING_SUPPORT).  From
+   * this point on every accepted message is captured into a preallocated
+   * circular buffer of CLOG_RING_SIZE records instead of going to the
+   * configured sink: the capture stores the call-site pointers, the capture
+   * time and the printf-expanded body, but performs no line formatting and
+   * no I/O.  Older records are overwritten as the ring wraps, so the buffer
+   * always holds the most recent messages.  Cannot fail: the storage is
+   * static, nothing is allocated.
+   *
+   */
+  void clog_init_ring(void);
+
+  /**
+   * Format and write the retained ring records to the given descriptor,
+   * oldest first, and typically called from a crash handler.  The records
+   * are rendered with the capture-time timestamp through the normal log
+   * format.  Only write() is used on the way out; note that with
+   * CLOG_TIME_SUPPORT the timestamp rendering goes through localtime and
+   * strftime, which are not async-signal-safe, so a dump from a signal
+   * handler is best effort.  The ring contents are left in place.
+   *
+   *
+   * @param fd
+   * Open file descriptor to write the formatted lines to, e.g. 2 for
+   * stderr or a freshly opened crash-report file.
+   *
+   * @return
+   * The number of messages written, or -1 if a write failed.
+   */
+  int clog_dump_ring(int fd);
+#endif /* CLOG_RING_SUPPORT */
+
+#ifdef CLOG_MULTI_SINK
+
+/* Maximum number of additional sinks the fan-out array can hold. */
+#ifndef CLOG_MAX_SINKS
+#define CLOG_MAX_SINKS 4
+#endif
+
+  /**
+   * Register an already-open descriptor as an additional sink (requires
+   * CLOG_MULTI_SINK).  Every message at or above min_level is delivered to
+   * it after the regular sink; the message is formatted only once no matter
+   * how many sinks receive it.  With a non-zero bufsize the sink batches
+   * messages like clog_init_file_buffered() does: the buffer is flushed
+   * when it fills up, after flush_interval_ms, on error-level messages, on
+   * clog_flush() and on clog_close_sinks().  The descriptor can be a file,
+   * a pipe or a socket; it stays owned by the caller and is not closed by
+   * clog_close_sinks().  The regular sink keeps working alongside the
+   * array; pass NULL to clog_init_console() to silence it and route
+   * everything through sinks.
+   *
+   *
+   * @param fd
+   * Open descriptor to write formatted messages to.
+   *
+   * @param min_level
+   * Lowest message level this sink accepts.
+   *
+   * @param bufsize
+   * Size of the sink's output buffer in bytes; zero writes every message
+   * straight away.
+   *
+   * @param flush_interval_ms
+   * Maximum age of a buffered message before it is forced out; zero
+   * flushes on buffer-full only.  Ignored when bufsize is zero.
+   *
+   * @return
+   * Zero on success, non-zero on failure (sink array full or buffer
+   * allocation failed).
+   */
+  int clog_add_sink_fd(int fd, enum clog_level min_level, size_t bufsize,
+      long flush_interval_ms);
+
+  /**
+   * Like clog_add_sink_fd(), but opens path in append mode first and closes
+   * it again in clog_close_sinks().
+   *
+   *
+   * @param path
+   * Path to the file where log messages will be written.
+   *
+   * @param min_level
+   * Lowest message level this sink accepts.
+   *
+   * @param bufsize
+   * Size of the sink's output buffer in bytes; zero writes every message
+   * straight away.
+   *
+   * @param flush_interval_ms
+   * Maximum age of a buffered message before it is forced out; zero
+   * flushes on buffer-full only.  Ignored when bufsize is zero.
+   *
+   * @return
+   * Zero on success, non-zero on failure.
+   */
+  int clog_add_sink_file(const char* const path, enum clog_level min_level,
+      size_t bufsize, long flush_interval_ms);
+
+  /**
+   * Register a console-style output function as an additional sink
+   * (requires CLOG_MULTI_SINK).  The function is called synchronously with
+   * the formatted message, never buffered.
+   *
+   *
+   * @param fun
+   * Function pointer for printing the message.
+   *
+   * @param min_level
+   * Lowest message level this sink accepts.
+   *
+   * @return
+   * Zero on success, non-zero on failure (sink array full).
+   */
+  int clog_add_sink_console(int (*fun)(const char* format, ...),
+      enum clog_level min_level);
+
+  /**
+   * Flushes every sink buffer, closes the descriptors opened by
+   * clog_add_sink_file() and empties the sink array.
+   *
+   */
+  void clog_close_sinks(void);
+
+#endif /* CLOG_MULTI_SINK */
+
   /*
    * No need to read below this point.
    */
@@ -260,36 +904,279 @@ extern "C" {
 #define POSIX_WRITE write
 #endif
 
-  /**
-  * The C logger structure.
-  */
-  struct clog {
-#ifdef CLOG_FILE_SUPPORT
-    /* The file being written. */
-    int fd;
-#endif /* CLOG_FILE_SUPPORT */
-    /* Points to a function writing a message. */
-    int (*fun)(const char* format, ...);
+#if defined(CLOG_THREAD_SAFE) || defined(CLOG_ASYNC)
+  /* CLOG_ASYNC needs this too: LOG_HEXDUMP and LOG_*_KV render on the
+   * calling thread while the flusher formats queued messages, so the
+   * scratch buffers must be per-thread in both threaded modes. */
+#ifdef _MSC_VER
+#define CLOG_THREAD_LOCAL __declspec(thread)
+#else
+#define CLOG_THREAD_LOCAL __thread
+#endif
+#else
+#define CLOG_THREAD_LOCAL
+#endif /* CLOG_THREAD_SAFE || CLOG_ASYNC */
 
-    /* The format specifier. */
-    char fmt[CLOG_FORMAT_LENGTH];
+#ifdef CLOG_THREAD_SAFE
+  /* Module levels can change at runtime from other threads; read them with a
+   * relaxed atomic load so the hot-path check stays a single load. */
+#define _CLOG_MODULE_LEVEL(cb) \
+    __atomic_load_n(&(cb).module_level, __ATOMIC_RELAXED)
+#define _CLOG_MODULE_LEVEL_STORE(cb, level) \
+    __atomic_store_n(&(cb)->module_level, (level), __ATOMIC_RELAXED)
+#define _CLOG_STAT_ADD(counter, n) \
+    __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#else
+#define _CLOG_MODULE_LEVEL(cb) ((cb).module_level)
+#define _CLOG_MODULE_LEVEL_STORE(cb, level) ((cb)->module_level = (level))
+#define _CLOG_STAT_ADD(counter, n) ((counter) += (n))
+#endif /* CLOG_THREAD_SAFE */
+
+#ifdef CLOG_BINARY
+
+#ifndef CLOG_FILE_SUPPORT
+#error "CLOG_BINARY requires CLOG_FILE_SUPPORT"
+#endif
+
+/* Binary record stream, decoded offline by tools/clog_decode.c.  Every record
+ * starts with an 8-byte header: type (u8), level (u8), site id (u16), payload
+ * length (u32), all in host byte order.
+ *
+ * CLOG_BIN_SITE payload: line (u32), then the NUL-terminated file name,
+ * function name, module name and format string of the call site.  Emitted
+ * once, the first time a site logs.
+ * CLOG_BIN_MSG payload: seconds since the epoch (u64), tick value (u64),
+ * then one tagged value per conversion in the site's format string.
+ * CLOG_BIN_TEXT payload: like CLOG_BIN_MSG but with a single NUL-terminated
+ * pre-rendered message; used when the format contains a conversion the
+ * argument capturer does not handle. */
+#define CLOG_BIN_SITE 1
+#define CLOG_BIN_MSG  2
+#define CLOG_BIN_TEXT 3
+
+/* Tags for captured argument values. */
+#define CLOG_BIN_ARG_INT 'i' /* u64 (two's complement for signed) */
+#define CLOG_BIN_ARG_DBL 'f' /* double, 8 bytes */
+#define CLOG_BIN_ARG_STR 's' /* u32 length, then that many bytes */
+#define CLOG_BIN_ARG_PTR 'p' /* u64 */
+
+/* Upper bound on one encoded record. */
+#define CLOG_BIN_RECORD_LENGTH 4096
+
+/* A captured %s argument is truncated to this many bytes. */
+#define CLOG_BIN_STR_MAX 512
+
+  void _clog_log_bin(unsigned short* site_id, const char* sfile, int sline,
+      const char* sfunction, clog_control_block_t* smodule,
+      enum clog_level level, const char* fmt, ...);
+
+#endif /* CLOG_BINARY */
+
+  int _clog_rl_check(clog_ratelimit_t* rl, unsigned int max_per_sec,
+      const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level);
+
+  /* Modules register their control block at startup so levels can be changed
+   * at runtime.  Registration uses a constructor function where the compiler
+   * supports it; elsewhere the registry stays empty and
+   * clog_set_module_level() reports the module as unknown. */
+  void _clog_register_module(clog_control_block_t* cb);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define _CLOG_REGISTER_MODULE(module) \
+static void __attribute__((constructor)) _clog_register_##module(void) \
+{ \
+    _clog_register_module(&clog_control_block_##module); \
+}
+#else
+#define _CLOG_REGISTER_MODULE(module)
+#endif
+
+  /* One step of a compiled log format: emit lit_len literal bytes, then
+   * expand the specifier (0 = literal run only). */
+  struct clog_fmt_token {
+    const char* lit;
+    size_t lit_len;
+    char spec;
+  };
+
+  /**
+  * The C logger structure.
+  */
+  struct clog {
+#ifdef CLOG_FILE_SUPPORT
+    /* The file being written. */
+    int fd;
+
+    /* Output buffer for clog_init_file_buffered(), or NULL when every
+     * message is written straight away. */
+    char* out_buf;
+    size_t out_len;
+    size_t out_cap;
+
+    /* Flush cadence for the output buffer (0 = flush on buffer-full only). */
+    long flush_interval_ms;
+    long last_flush_ms;
+
+    /* Multi-process mode (clog_init_file_shared): flushes are split into
+     * line-aligned writes of at most this many bytes; 0 = normal flush. */
+    size_t shared_chunk;
+
+    /* Rotation state (clog_init_file_rotating); rot_max_bytes == 0 turns
+     * rotation off. */
+    char rot_path[CLOG_PATH_LENGTH];
+    size_t rot_max_bytes;
+    int rot_max_files;
+    size_t rot_written;
+
+#ifdef CLOG_MMAP_SUPPORT
+    /* Memory-mapped sink state (clog_init_file_mmap), map == NULL when the
+     * sink is not memory-mapped. */
+    char* map;
+    size_t map_size;
+    size_t map_off;
+#endif /* CLOG_MMAP_SUPPORT */
+#ifdef CLOG_DIRECT_SUPPORT
+    /* Direct-I/O staging state (clog_init_file_direct), dio_buf == NULL
+     * when the sink is not in direct mode.  dio_base is the aligned file
+     * offset the staging buffer writes to. */
+    char* dio_buf;
+    size_t dio_len;
+    size_t dio_cap;
+    size_t dio_block;
+    size_t dio_base;
+
+    /* fdatasync cadence (clog_set_sync_policy); all zero = never sync
+     * explicitly. */
+    size_t sync_bytes;
+    long sync_interval_ms;
+    int sync_on_error;
+    size_t sync_pending;
+    long last_sync_ms;
+#endif /* CLOG_DIRECT_SUPPORT */
+#ifdef CLOG_COMPRESS_SUPPORT
+    /* Compressed sink staging (clog_init_file_compressed), z_in == NULL
+     * when the sink is not compressed.  z_out holds one worst-case
+     * compressed block. */
+    char* z_in;
+    size_t z_len;
+    size_t z_cap;
+    char* z_out;
+#endif /* CLOG_COMPRESS_SUPPORT */
+#endif /* CLOG_FILE_SUPPORT */
+#ifdef CLOG_SOCKET_SUPPORT
+    /* Connected non-blocking datagram socket (clog_init_socket), 0 when the
+     * sink is not a socket. */
+    int sock;
+#endif /* CLOG_SOCKET_SUPPORT */
+    /* Points to a function writing a message. */
+    int (*fun)(const char* format, ...);
+
+    /* The format specifier: the default literal, or the backing store
+     * filled by clog_set_format().  A pointer rather than an embedded
+     * array so the whole logger constant-initializes into a few words and
+     * no literals are copied at startup - the logger is usable from
+     * static initializers and shared-object constructors in any load
+     * order, with early messages going to the default console function
+     * until a sink is configured. */
+    const char* fmt;
+
+    /* The format, compiled into tokens (0 tokens = compile on first use). */
+    struct clog_fmt_token tokens[CLOG_FORMAT_TOKENS];
+    int ntokens;
 
     /* Date format */
-    char date_fmt[CLOG_FORMAT_LENGTH];
+    const char* date_fmt;
 
     /* Time format */
-    char time_fmt[CLOG_FORMAT_LENGTH];
+    const char* time_fmt;
   };
 
   void _clog_err(const char* fmt, ...);
 
+  void _clog_log(const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level,
+      const char* fmt, ...);
+
+#ifdef CLOG_BINARY
+  void _clog_log_hexdump(unsigned short* site_id, const char* sfile,
+      int sline, const char* sfunction, clog_control_block_t* smodule,
+      enum clog_level level, const void* data, size_t len);
+#else
+  void _clog_log_hexdump(const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level,
+      const void* data, size_t len);
+#endif /* CLOG_BINARY */
+
+  /* Type tags threaded through the variadic call by the CLOG_U64/CLOG_I64/
+   * CLOG_F64/CLOG_STR/CLOG_BOOL field macros; _CLOG_KV_END terminates the
+   * list.  Internal - user code never names these directly. */
+  enum _clog_kv_tag {
+    _CLOG_KV_END = 0,
+    _CLOG_KV_U64,
+    _CLOG_KV_I64,
+    _CLOG_KV_F64,
+    _CLOG_KV_STR,
+    _CLOG_KV_BOOL
+  };
+
+#ifdef CLOG_BINARY
+  void _clog_log_kv(unsigned short* site_id, const char* sfile, int sline,
+      const char* sfunction, clog_control_block_t* smodule,
+      enum clog_level level, const char* msg, ...);
+#else
+  void _clog_log_kv(const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level,
+      const char* msg, ...);
+#endif /* CLOG_BINARY */
+
+  const char* _clog_basename(const char* path);
+
 #ifdef CLOG_MAIN
   struct clog _clog_logger = {
 #ifdef CLOG_FILE_SUPPORT
     0,
+    NULL,
+    0,
+    0,
+    0,
+    0,
+    0,
+    { 0 },
+    0,
+    0,
+    0,
+#ifdef CLOG_MMAP_SUPPORT
+    NULL,
+    0,
+    0,
+#endif /* CLOG_MMAP_SUPPORT */
+#ifdef CLOG_DIRECT_SUPPORT
+    NULL,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+#endif /* CLOG_DIRECT_SUPPORT */
+#ifdef CLOG_COMPRESS_SUPPORT
+    NULL,
+    0,
+    0,
+    NULL,
+#endif /* CLOG_COMPRESS_SUPPORT */
 #endif /* CLOG_FILE_SUPPORT */
+#ifdef CLOG_SOCKET_SUPPORT
+    0,
+#endif /* CLOG_SOCKET_SUPPORT */
     CLOG_DEFAULT_MESSAGE_FUNCTION,
     CLOG_DEFAULT_FORMAT,
+    { { NULL, 0, 0 } },
+    0,
     CLOG_DEFAULT_DATE_FORMAT,
     CLOG_DEFAULT_TIME_FORMAT
   };
@@ -306,6 +1193,114 @@ extern "C" {
       "E",
   };
 
+  /* The module registry.  Filled by constructor functions before main() (and
+   * before threads exist), so plain stores are fine here. */
+  clog_control_block_t* _clog_modules[CLOG_MAX_MODULES];
+  int _clog_nmodules = 0;
+
+  void _clog_register_module(clog_control_block_t* cb)
+  {
+    if (_clog_nmodules >= CLOG_MAX_MODULES) {
+      _clog_err("Too many modules, raise CLOG_MAX_MODULES\n");
+      return;
+    }
+    _clog_modules[_clog_nmodules++] = cb;
+  }
+
+  const clog_control_block_t* clog_get_stats(const char* name)
+  {
+    int i;
+
+    for (i = 0; i < _clog_nmodules; ++i) {
+      if (strcmp(_clog_modules[i]->module_name, name) == 0) {
+        return _clog_modules[i];
+      }
+    }
+    return NULL;
+  }
+
+  /* The stats reporter logs through a module of its own, so the report
+   * lines carry a name and can be leveled like everything else. */
+  clog_control_block_t _clog_stats_cb = { "CLOG", LEVEL_INFO,
+    0, 0, 0, 0, 0 };
+
+  void clog_log_stats(void)
+  {
+    static int registered = 0;
+    clog_control_block_t* cb;
+    int i;
+
+    if (!registered) {
+      _clog_register_module(&_clog_stats_cb);
+      registered = 1;
+    }
+    for (i = 0; i < _clog_nmodules; ++i) {
+      cb = _clog_modules[i];
+      if (cb == &_clog_stats_cb ||
+          (cb->emitted == 0 && cb->suppressed == 0 && cb->dropped == 0)) {
+        continue;
+      }
+#ifdef CLOG_BINARY
+      {
+        /* In binary mode the report has to be a record, not a text line. */
+        static unsigned short _clog_stats_site = 0;
+        _clog_log_bin(&_clog_stats_site, "clog.h", 0, "clog_log_stats",
+          &_clog_stats_cb, LEVEL_INFO,
+          "%s: emitted=%lu suppressed=%lu dropped=%lu bytes=%lu "
+          "flush_stalls=%lu", cb->module_name, cb->emitted, cb->suppressed,
+          cb->dropped, cb->bytes, cb->flush_stalls);
+      }
+#else
+      _clog_log("clog.h", 0, "clog_log_stats", &_clog_stats_cb, LEVEL_INFO,
+        "%s: emitted=%lu suppressed=%lu dropped=%lu bytes=%lu "
+        "flush_stalls=%lu", cb->module_name, cb->emitted, cb->suppressed,
+        cb->dropped, cb->bytes, cb->flush_stalls);
+#endif /* CLOG_BINARY */
+    }
+  }
+
+  int clog_set_level(const char* pattern, enum clog_level level)
+  {
+    size_t n = strlen(pattern);
+    int matched = 0;
+    int i;
+
+    if (n == 0 || pattern[n - 1] != '*') {
+      return clog_set_module_level(pattern, level);
+    }
+    --n; /* prefix match: "NET.*" covers NET.TCP, NET.HTTP, ... */
+    for (i = 0; i < _clog_nmodules; ++i) {
+      if (strncmp(_clog_modules[i]->module_name, pattern, n) == 0) {
+        _CLOG_MODULE_LEVEL_STORE(_clog_modules[i], level);
+        matched = 1;
+      }
+    }
+    return matched ? 0 : 1;
+  }
+
+  int clog_set_module_level(const char* name, enum clog_level level)
+  {
+    int i;
+
+    for (i = 0; i < _clog_nmodules; ++i) {
+      if (strcmp(_clog_modules[i]->module_name, name) == 0) {
+        _CLOG_MODULE_LEVEL_STORE(_clog_modules[i], level);
+        return 0;
+      }
+    }
+    _clog_err("Unknown module %s\n", name);
+    return 1;
+  }
+
+  void clog_set_all_levels(enum clog_level level)
+  {
+    int i;
+
+    for (i = 0; i < _clog_nmodules; ++i) {
+      _CLOG_MODULE_LEVEL_STORE(_clog_modules[i], level);
+    }
+  }
+
   int clog_init_file(const char* const path)
   {
 #ifdef CLOG_FILE_SUPPORT
@@ -317,7 +1312,7 @@ extern "C" {
 
     _clog_logger.fd = fd;
     _clog_logger.fun = NULL;
-    return 1;
+    return 0;
 #else
     _clog_logger.fun = NULL;
 #endif
@@ -325,186 +1320,2326 @@ extern "C" {
   }
 
 
-  int clog_init_console(int (*fun)(const char* format, ...))
+#if (defined(CLOG_THREAD_SAFE) || defined(CLOG_ASYNC)) && \
+    (defined(CLOG_FILE_SUPPORT) || defined(CLOG_MULTI_SINK))
+  /* Serializes access to the shared output buffers (the buffered file sink
+   * and, with CLOG_MULTI_SINK, the per-sink buffers).  The unbuffered fd
+   * path and the console path stay lock-free: they issue one write/call per
+   * message, which is already line-atomic.  CLOG_ASYNC counts as threaded
+   * here: LOG_HEXDUMP and LOG_*_KV deliver from the calling thread and
+   * would otherwise race the flusher over the buffered-sink state. */
+  pthread_mutex_t _clog_out_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define _CLOG_OUT_LOCK()   pthread_mutex_lock(&_clog_out_mutex)
+#define _CLOG_OUT_UNLOCK() pthread_mutex_unlock(&_clog_out_mutex)
+#else
+#define _CLOG_OUT_LOCK()
+#define _CLOG_OUT_UNLOCK()
+#endif
+
+  /* Monotonic-ish millisecond clock used for the buffered flush cadence and
+   * the rate-limiter windows. */
+  long _clog_now_ms(void)
   {
-    if (fun == NULL)
-    {
-      _clog_err("Invalid pointer\n");
+#ifdef _WIN32
+    return (long)(time(NULL) * 1000);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+  }
+
+  /* Decides whether a rate-limited site may emit.  When a new window opens
+   * after drops, a one-line summary goes out first so nothing disappears
+   * silently.  Counting is unsynchronized on purpose: under concurrency the
+   * limit is approximate, which is fine for its job of keeping a pathological
+   * site from drowning the sink. */
+  int _clog_rl_check(clog_ratelimit_t* rl, unsigned int max_per_sec,
+      const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level)
+  {
+    long now = _clog_now_ms();
+
+    if (now - rl->window_ms >= 1000) {
+      if (rl->suppressed) {
+#ifndef CLOG_BINARY
+        _clog_log(_clog_basename(sfile), sline, sfunction, smodule, level,
+          "last message repeated %lu times", rl->suppressed);
+#else
+        (void)sfile;
+        (void)sline;
+        (void)sfunction;
+        (void)smodule;
+        (void)level;
+#endif
+        rl->suppressed = 0;
+      }
+      rl->window_ms = now;
+      rl->count = 0;
+    }
+    if (rl->count < max_per_sec) {
+      ++rl->count;
       return 1;
     }
-#ifdef CLOG_FILE_SUPPORT
-    _clog_logger.fd = 0;
-#endif /* CLOG_FILE_SUPPORT */
-    _clog_logger.fun = fun;
+    ++rl->suppressed;
     return 0;
   }
 
-  void clog_close_file(void)
-  {
 #ifdef CLOG_FILE_SUPPORT
-    if (_clog_logger.fd)
-    {
-      POSIX_CLOSE(_clog_logger.fd);
-    }
+
+/* Largest single write issued in multi-process mode (clog_init_file_shared).
+ * Writes on a shared O_APPEND descriptor land contiguously, so this caps how
+ * much one process appends per syscall, not a correctness limit. */
+#ifndef CLOG_SHARED_CHUNK
+#define CLOG_SHARED_CHUNK 65536
 #endif
+
+  /* Writes out whatever is sitting in the output buffer.  In multi-process
+   * mode the buffer goes out as line-aligned writes of at most shared_chunk
+   * bytes each, so concurrent appenders to the same file interleave whole
+   * groups of lines, never fragments. */
+  void _clog_file_flush(void)
+  {
+    struct clog* logger = &_clog_logger;
+
+    if (logger->out_buf && logger->out_len) {
+      size_t done = 0;
+
+      while (done < logger->out_len) {
+        size_t n = logger->out_len - done;
+
+        if (logger->shared_chunk && n > logger->shared_chunk) {
+          /* Cut back to the last newline inside the chunk. */
+          n = logger->shared_chunk;
+          while (n && logger->out_buf[done + n - 1] != '\n') {
+            --n;
+          }
+          if (n == 0) {
+            /* A single line longer than the chunk: find its end and write
+             * it whole; one oversized write still cannot interleave. */
+            n = logger->shared_chunk;
+            while (done + n < logger->out_len &&
+                logger->out_buf[done + n - 1] != '\n') {
+              ++n;
+            }
+          }
+        }
+        if (POSIX_WRITE(logger->fd, logger->out_buf + done, n) == -1) {
+          _clog_err("Unable to write to log file: %s\n", strerror(errno));
+          break;
+        }
+        done += n;
+      }
+      logger->out_len = 0;
+    }
+    logger->last_flush_ms = _clog_now_ms();
   }
+#endif /* CLOG_FILE_SUPPORT */
 
-  /* Internal functions */
+#ifdef CLOG_MULTI_SINK
+  /* One additional destination of the fan-out. */
+  struct _clog_sink {
+    int fd;
+    int owns_fd;
+    int (*fun)(const char* format, ...);
+    enum clog_level min_level;
+
+    /* Per-sink output buffer, NULL when the sink is unbuffered. */
+    char* buf;
+    size_t len;
+    size_t cap;
+    long flush_interval_ms;
+    long last_flush_ms;
+  };
+
+  struct _clog_sink _clog_sinks[CLOG_MAX_SINKS];
+  int _clog_nsinks = 0;
 
-  size_t _clog_append_str(char** dst, char* orig_buf, const char* src, size_t cur_size)
+  int clog_add_sink_fd(int fd, enum clog_level min_level, size_t bufsize,
+      long flush_interval_ms)
   {
-    size_t new_size = cur_size;
+    struct _clog_sink* s;
+    char* buf = NULL;
 
-    while (strlen(*dst) + strlen(src) >= new_size) {
-      new_size *= 2;
+    if (_clog_nsinks >= CLOG_MAX_SINKS) {
+      _clog_err("Too many sinks, raise CLOG_MAX_SINKS\n");
+      return 1;
     }
-    if (new_size != cur_size) {
-      if (*dst == orig_buf) {
-        *dst = (char*)malloc(new_size);
-        strcpy(*dst, orig_buf);
-      }
-      else {
-        *dst = (char*)realloc(*dst, new_size);
+    if (bufsize) {
+      buf = (char*)malloc(bufsize);
+      if (buf == NULL) {
+        _clog_err("Unable to allocate sink buffer: %s\n", strerror(errno));
+        return 1;
       }
     }
-
-    strcat(*dst, src);
-    return new_size;
+    s = &_clog_sinks[_clog_nsinks];
+    s->fd = fd;
+    s->owns_fd = 0;
+    s->fun = NULL;
+    s->min_level = min_level;
+    s->buf = buf;
+    s->len = 0;
+    s->cap = bufsize;
+    s->flush_interval_ms = flush_interval_ms;
+    s->last_flush_ms = _clog_now_ms();
+    /* Fill the slot before publishing it so a concurrent _clog_emit never
+     * sees a half-initialized sink. */
+    ++_clog_nsinks;
+    return 0;
   }
 
-  size_t _clog_append_int(char** dst, char* orig_buf, long int d, size_t cur_size)
+  int clog_add_sink_file(const char* const path, enum clog_level min_level,
+      size_t bufsize, long flush_interval_ms)
   {
-    char buf[40]; /* Enough for 128-bit decimal */
-    if (snprintf(buf, 40, "%ld", d) >= 40) {
-      return cur_size;
+    int fd = POSIX_OPEN(path, O_CREAT | O_WRONLY | O_APPEND, 0666);
+    if (fd == -1) {
+      _clog_err("Unable to open %s: %s\n", path, strerror(errno));
+      return 1;
+    }
+    if (clog_add_sink_fd(fd, min_level, bufsize, flush_interval_ms)) {
+      POSIX_CLOSE(fd);
+      return 1;
     }
-    return _clog_append_str(dst, orig_buf, buf, cur_size);
+    _clog_sinks[_clog_nsinks - 1].owns_fd = 1;
+    return 0;
   }
 
-#ifdef CLOG_TIME_SUPPORT
-  size_t _clog_append_time(char** dst, char* orig_buf, struct tm* lt,
-      const char* fmt, size_t cur_size)
+  int clog_add_sink_console(int (*fun)(const char* format, ...),
+      enum clog_level min_level)
   {
-    char buf[CLOG_DATETIME_LENGTH];
-    size_t result = strftime(buf, CLOG_DATETIME_LENGTH, fmt, lt);
-
-    if (result > 0) {
-      return _clog_append_str(dst, orig_buf, buf, cur_size);
+    if (clog_add_sink_fd(0, min_level, 0, 0)) {
+      return 1;
     }
-
-    return cur_size;
+    _clog_sinks[_clog_nsinks - 1].fun = fun;
+    return 0;
   }
-#endif /* CLOG_TIME_SUPPORT */
 
+  /* Writes out whatever is sitting in one sink's buffer.  Callers hold the
+   * output lock with CLOG_THREAD_SAFE. */
+  void _clog_sink_flush(struct _clog_sink* s)
+  {
+    if (s->buf && s->len) {
+      if (POSIX_WRITE(s->fd, s->buf, s->len) == -1) {
+        _clog_err("Unable to write to sink: %s\n", strerror(errno));
+      }
+      s->len = 0;
+    }
+    s->last_flush_ms = _clog_now_ms();
+  }
 
-  const char* _clog_basename(const char* path)
+  /* Hands one formatted message to one sink, honoring its buffering
+   * policy.  Mirrors the buffered-file logic of _clog_emit. */
+  void _clog_sink_deliver(struct _clog_sink* s, enum clog_level level,
+      const char* message, size_t len)
   {
-    const char* slash = strrchr(path, '/');
-    if (slash) {
-      path = slash + 1;
+    if (s->fun) {
+      s->fun(message);
+      return;
     }
-#ifdef _WIN32
-    slash = strrchr(path, '\\');
-    if (slash) {
-      path = slash + 1;
+    if (s->buf) {
+      if (s->len + len > s->cap) {
+        _clog_sink_flush(s);
+      }
+      if (len > s->cap) {
+        if (POSIX_WRITE(s->fd, message, len) == -1) {
+          _clog_err("Unable to write to sink: %s\n", strerror(errno));
+        }
+        return;
+      }
+      memcpy(s->buf + s->len, message, len);
+      s->len += len;
+      if (level == LEVEL_ERROR ||
+          (s->flush_interval_ms > 0 &&
+           _clog_now_ms() - s->last_flush_ms >= s->flush_interval_ms)) {
+        _clog_sink_flush(s);
+      }
+      return;
+    }
+    if (POSIX_WRITE(s->fd, message, len) == -1) {
+      _clog_err("Unable to write to sink: %s\n", strerror(errno));
     }
-#endif
-    return path;
   }
 
-  char*  _clog_format(const struct clog* logger, char buf[], size_t buf_size,
-      const char* sfile, int sline, const char* sfunction,
-      const char* smodule, const char* level, const char* message)
+  void clog_close_sinks(void)
   {
-    size_t cur_size = buf_size;
-    char* result = buf;
-    enum { NORMAL, SUBST } state = NORMAL;
-    size_t fmtlen = strlen(logger->fmt);
-    size_t i;
-#ifdef CLOG_TIME_SUPPORT
-    time_t t = time(NULL);
-    struct tm* lt = localtime(&t);
-    clock_t ticks = clock();
-#endif /* CLOG_TIME_SUPPORT */
+    int i;
 
-    sfile = _clog_basename(sfile);
-    result[0] = 0;
-    for (i = 0; i < fmtlen; ++i) {
-      if (state == NORMAL) {
-        if (logger->fmt[i] == '%') {
-          state = SUBST;
-        }
-        else {
-          char str[2] = { 0 };
-          str[0] = logger->fmt[i];
-          cur_size = _clog_append_str(&result, buf, str, cur_size);
-        }
+    _CLOG_OUT_LOCK();
+    for (i = 0; i < _clog_nsinks; ++i) {
+      _clog_sink_flush(&_clog_sinks[i]);
+      if (_clog_sinks[i].owns_fd) {
+        POSIX_CLOSE(_clog_sinks[i].fd);
       }
-      else {
-        switch (logger->fmt[i]) {
-        case '%':
-          cur_size = _clog_append_str(&result, buf, "%", cur_size);
-          break;
-#ifdef CLOG_TIME_SUPPORT
-        case 't':
-          cur_size = _clog_append_time(&result, buf, lt,
-            logger->time_fmt, cur_size);
-          break;
-        case 'd':
-          cur_size = _clog_append_time(&result, buf, lt,
-            logger->date_fmt, cur_size);
-          break;
-        case 'h':
-          cur_size = _clog_append_int(&result, buf, ticks, cur_size);
-          break;
-#endif /* CLOG_TIME_SUPPORT */
-        case 'l':
-          cur_size = _clog_append_str(&result, buf, level, cur_size);
-          break;
-        case 'e':
-          cur_size = _clog_append_str(&result, buf, smodule, cur_size);
-          break;
-        case 'g':
-          cur_size = _clog_append_str(&result, buf, sfunction, cur_size);
-          break;
-        case 'n':
-          cur_size = _clog_append_int(&result, buf, sline, cur_size);
-          break;
-        case 'f':
-          cur_size = _clog_append_str(&result, buf, sfile, cur_size);
-          break;
-        case 'm':
-          cur_size = _clog_append_str(&result, buf, message,
-            cur_size);
-          break;
-        }
-        state = NORMAL;
+      if (_clog_sinks[i].buf) {
+        free(_clog_sinks[i].buf);
+        _clog_sinks[i].buf = NULL;
+        _clog_sinks[i].cap = 0;
       }
     }
+    _clog_nsinks = 0;
+    _CLOG_OUT_UNLOCK();
+  }
+#endif /* CLOG_MULTI_SINK */
+
+#ifdef CLOG_MMAP_SUPPORT
+  /* Extends the file and remaps it so at least need more bytes fit. */
+  int _clog_mmap_grow(struct clog* logger, size_t need)
+  {
+    size_t new_size = logger->map_size;
 
-    return result;
+    while (new_size < logger->map_off + need) {
+      new_size *= 2;
+    }
+    if (ftruncate(logger->fd, (off_t)new_size) == -1) {
+      _clog_err("Unable to grow log file: %s\n", strerror(errno));
+      return 1;
+    }
+    munmap(logger->map, logger->map_size);
+    logger->map = (char*)mmap(NULL, new_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, logger->fd, 0);
+    if (logger->map == MAP_FAILED) {
+      _clog_err("Unable to remap log file: %s\n", strerror(errno));
+      logger->map = NULL;
+      return 1;
+    }
+    logger->map_size = new_size;
+    return 0;
   }
 
-  void  _clog_log(const char* sfile, int sline, const char* sfunction, const char* smodule,
-      enum clog_level level, const char* fmt, ...)
+  void _clog_mmap_append(struct clog* logger, const char* message, size_t len)
+  {
+    if (logger->map_off + len > logger->map_size) {
+      if (_clog_mmap_grow(logger, len)) {
+        return;
+      }
+    }
+    memcpy(logger->map + logger->map_off, message, len);
+    logger->map_off += len;
+  }
+#endif /* CLOG_MMAP_SUPPORT */
+
+  int clog_init_file_mmap(const char* const path, size_t initial_size)
   {
-    /* For speed: Use a stack buffer until message exceeds 4096, then switch
+#ifdef CLOG_MMAP_SUPPORT
+    int fd;
+    struct stat st;
+    size_t size;
+
+    fd = POSIX_OPEN(path, O_CREAT | O_RDWR, 0666);
+    if (fd == -1) {
+      _clog_err("Unable to open %s: %s\n", path, strerror(errno));
+      return 1;
+    }
+    if (fstat(fd, &st) == -1) {
+      _clog_err("Unable to stat %s: %s\n", path, strerror(errno));
+      POSIX_CLOSE(fd);
+      return 1;
+    }
+    /* Preallocate past the current end; existing contents are kept and
+     * appended to, like the O_APPEND sink. */
+    size = (size_t)st.st_size + (initial_size ? initial_size : 4096);
+    if (ftruncate(fd, (off_t)size) == -1) {
+      _clog_err("Unable to preallocate %s: %s\n", path, strerror(errno));
+      POSIX_CLOSE(fd);
+      return 1;
+    }
+    _clog_logger.map = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+    if (_clog_logger.map == MAP_FAILED) {
+      _clog_err("Unable to map %s: %s\n", path, strerror(errno));
+      _clog_logger.map = NULL;
+      POSIX_CLOSE(fd);
+      return 1;
+    }
+    _clog_logger.map_size = size;
+    _clog_logger.map_off = (size_t)st.st_size;
+    _clog_logger.fd = fd;
+    _clog_logger.fun = NULL;
+    return 0;
+#else
+    (void)path;
+    (void)initial_size;
+    _clog_logger.fun = NULL;
+    return 0;
+#endif
+  }
+
+#ifdef CLOG_DIRECT_SUPPORT
+  int clog_init_file_direct(const char* const path, size_t block_bytes,
+      size_t bufblocks)
+  {
+    struct stat st;
+    void* buf;
+    size_t cap;
+    size_t base;
+    size_t tail;
+    int flags = O_CREAT | O_RDWR; /* RDWR: the tail preload reads back */
+    int fd;
+
+    if (block_bytes < 512 || (block_bytes & (block_bytes - 1)) != 0 ||
+        bufblocks == 0) {
+      _clog_err("Invalid direct-I/O geometry\n");
+      return 1;
+    }
+#ifdef O_DIRECT
+    fd = POSIX_OPEN(path, flags | O_DIRECT, 0666);
+    if (fd == -1 && errno == EINVAL) {
+      /* The filesystem rejects O_DIRECT (tmpfs and friends): keep the
+       * aligned staging discipline, lose only the page-cache bypass. */
+      fd = POSIX_OPEN(path, flags, 0666);
+    }
+#else
+    fd = POSIX_OPEN(path, flags, 0666);
+#endif /* O_DIRECT */
+    if (fd == -1) {
+      _clog_err("Unable to open %s: %s\n", path, strerror(errno));
+      return 1;
+    }
+    if (fstat(fd, &st) == -1) {
+      _clog_err("Unable to stat %s: %s\n", path, strerror(errno));
+      POSIX_CLOSE(fd);
+      return 1;
+    }
+    cap = block_bytes * bufblocks;
+    if (posix_memalign(&buf, block_bytes, cap)) {
+      _clog_err("Unable to allocate staging buffer\n");
+      POSIX_CLOSE(fd);
+      return 1;
+    }
+    /* Resume at the aligned offset below the current end; the unaligned
+     * tail of an existing file is pulled back into the staging buffer so
+     * every pwrite stays block-aligned. */
+    base = (size_t)st.st_size & ~(block_bytes - 1);
+    tail = (size_t)st.st_size - base;
+    if (tail &&
+        pread(fd, buf, block_bytes, (off_t)base) < (ssize_t)tail) {
+      _clog_err("Unable to read %s: %s\n", path, strerror(errno));
+      free(buf);
+      POSIX_CLOSE(fd);
+      return 1;
+    }
+    _clog_logger.dio_buf = (char*)buf;
+    _clog_logger.dio_len = tail;
+    _clog_logger.dio_cap = cap;
+    _clog_logger.dio_block = block_bytes;
+    _clog_logger.dio_base = base;
+    _clog_logger.fd = fd;
+    _clog_logger.fun = NULL;
+    return 0;
+  }
+
+  void clog_set_sync_policy(size_t every_bytes, long every_ms, int on_error)
+  {
+    _clog_logger.sync_bytes = every_bytes;
+    _clog_logger.sync_interval_ms = every_ms;
+    _clog_logger.sync_on_error = on_error;
+    _clog_logger.sync_pending = 0;
+    _clog_logger.last_sync_ms = _clog_now_ms();
+  }
+
+  /* Copies one message into the staging buffer and writes out every whole
+   * block that is ready.  Callers hold the output lock with
+   * CLOG_THREAD_SAFE. */
+  void _clog_dio_append(struct clog* logger, const char* message, size_t len)
+  {
+    size_t chunk;
+    size_t whole;
+
+    while (len) {
+      chunk = logger->dio_cap - logger->dio_len;
+      if (chunk > len) {
+        chunk = len;
+      }
+      memcpy(logger->dio_buf + logger->dio_len, message, chunk);
+      logger->dio_len += chunk;
+      message += chunk;
+      len -= chunk;
+      whole = logger->dio_len & ~(logger->dio_block - 1);
+      if (whole) {
+        if (pwrite(logger->fd, logger->dio_buf, whole,
+            (off_t)logger->dio_base) == -1) {
+          _clog_err("Unable to write to log file: %s\n", strerror(errno));
+        }
+        logger->dio_base += whole;
+        logger->dio_len -= whole;
+        memmove(logger->dio_buf, logger->dio_buf + whole, logger->dio_len);
+      }
+    }
+  }
+
+  /* Makes the partially filled tail block visible on disk: it goes out
+   * padded with zeros and is rewritten in place as it fills.  The padding
+   * is trimmed by clog_close_file(). */
+  void _clog_dio_flush(struct clog* logger)
+  {
+    size_t padded;
+
+    if (logger->dio_len == 0) {
+      return;
+    }
+    padded = (logger->dio_len + logger->dio_block - 1) &
+      ~(logger->dio_block - 1);
+    memset(logger->dio_buf + logger->dio_len, 0, padded - logger->dio_len);
+    if (pwrite(logger->fd, logger->dio_buf, padded,
+        (off_t)logger->dio_base) == -1) {
+      _clog_err("Unable to write to log file: %s\n", strerror(errno));
+    }
+  }
+
+  /* Runs the fdatasync cadence after a message was written. */
+  void _clog_maybe_sync(struct clog* logger, enum clog_level level,
+      size_t nbytes)
+  {
+    if (logger->sync_bytes == 0 && logger->sync_interval_ms <= 0 &&
+        !logger->sync_on_error) {
+      return;
+    }
+    /* Unsynchronized accounting: under concurrency the cadence is
+     * approximate, which is fine for a durability knob. */
+    logger->sync_pending += nbytes;
+    if ((logger->sync_on_error && level == LEVEL_ERROR) ||
+        (logger->sync_bytes && logger->sync_pending >= logger->sync_bytes) ||
+        (logger->sync_interval_ms > 0 &&
+         _clog_now_ms() - logger->last_sync_ms >= logger->sync_interval_ms)) {
+      if (logger->dio_buf) {
+        _CLOG_OUT_LOCK();
+        _clog_dio_flush(logger);
+        _CLOG_OUT_UNLOCK();
+      }
+      if (fdatasync(logger->fd) == -1) {
+        _clog_err("Unable to sync log file: %s\n", strerror(errno));
+      }
+      logger->sync_pending = 0;
+      logger->last_sync_ms = _clog_now_ms();
+    }
+  }
+#endif /* CLOG_DIRECT_SUPPORT */
+
+#ifdef CLOG_COMPRESS_SUPPORT
+/* Staging block size; one LZ4 frame block goes out per full batch. */
+#ifndef CLOG_COMPRESS_BLOCK
+#define CLOG_COMPRESS_BLOCK 65536
+#endif
+#if CLOG_COMPRESS_BLOCK > 4194304
+#error "CLOG_COMPRESS_BLOCK cannot exceed the 4MB LZ4 frame block limit"
+#endif
+
+/* A partial batch is flushed once it has been sitting this long. */
+#ifndef CLOG_COMPRESS_FLUSH_MS
+#define CLOG_COMPRESS_FLUSH_MS 1000
+#endif
+
+  unsigned int _clog_z_read32(const void* p)
+  {
+    unsigned int v;
+
+    memcpy(&v, p, 4);
+    return v;
+  }
+
+  /* xxHash32 over the LZ4 frame descriptor; the input is always shorter
+   * than 16 bytes, so the stripe loop of the full algorithm is omitted. */
+  unsigned int _clog_xxh32(const unsigned char* p, size_t len,
+      unsigned int seed)
+  {
+    const unsigned char* end = p + len;
+    unsigned int h = seed + 374761393u + (unsigned int)len;
+
+    while (p + 4 <= end) {
+      h += _clog_z_read32(p) * 3266489917u;
+      h = ((h << 17) | (h >> 15)) * 668265263u;
+      p += 4;
+    }
+    while (p < end) {
+      h += (unsigned int)*p * 374761393u;
+      h = ((h << 11) | (h >> 21)) * 2654435761u;
+      ++p;
+    }
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    h *= 3266489917u;
+    h ^= h >> 16;
+    return h;
+  }
+
+  /* Greedy LZ4 block compressor: a 4096-entry table remembers the last
+   * position of each 4-byte prefix and every confirmed match becomes one
+   * standard token/literals/offset sequence.  Returns the compressed size,
+   * or 0 when the output does not fit in dcap (the caller then stores the
+   * block uncompressed).  Runs under the output lock, which also guards
+   * the static table. */
+  size_t _clog_lz4_compress(const unsigned char* src, size_t slen,
+      unsigned char* dst, size_t dcap)
+  {
+    static unsigned int tab[4096]; /* position + 1; 0 = empty slot */
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+    size_t mflimit;
+    size_t matchend;
+    size_t ref;
+    size_t mlen;
+    size_t litlen;
+    size_t n;
+
+    memset(tab, 0, sizeof(tab));
+    if (slen > 12) {
+      /* The format requires the last match to start at least 12 bytes
+       * before the end and to stop short of the last 5. */
+      mflimit = slen - 12;
+      matchend = slen - 5;
+      while (ip < mflimit) {
+        unsigned int h =
+          (_clog_z_read32(src + ip) * 2654435761u) >> 20;
+
+        ref = tab[h];
+        tab[h] = (unsigned int)ip + 1;
+        if (ref == 0 || ip + 1 - ref > 65535 ||
+            _clog_z_read32(src + ref - 1) != _clog_z_read32(src + ip)) {
+          ++ip;
+          continue;
+        }
+        --ref;
+        mlen = 4;
+        while (ip + mlen < matchend && src[ref + mlen] == src[ip + mlen]) {
+          ++mlen;
+        }
+        litlen = ip - anchor;
+        if (op + litlen + litlen / 255 + mlen / 255 + 6 > dcap) {
+          return 0;
+        }
+        dst[op++] = (unsigned char)(
+          ((litlen < 15 ? litlen : 15) << 4) |
+          (mlen - 4 < 15 ? mlen - 4 : 15));
+        if (litlen >= 15) {
+          for (n = litlen - 15; n >= 255; n -= 255) {
+            dst[op++] = 255;
+          }
+          dst[op++] = (unsigned char)n;
+        }
+        memcpy(dst + op, src + anchor, litlen);
+        op += litlen;
+        dst[op++] = (unsigned char)((ip - ref) & 0xff);
+        dst[op++] = (unsigned char)((ip - ref) >> 8);
+        if (mlen - 4 >= 15) {
+          for (n = mlen - 4 - 15; n >= 255; n -= 255) {
+            dst[op++] = 255;
+          }
+          dst[op++] = (unsigned char)n;
+        }
+        ip += mlen;
+        anchor = ip;
+      }
+    }
+    litlen = slen - anchor;
+    if (op + litlen + litlen / 255 + 2 > dcap) {
+      return 0;
+    }
+    dst[op++] = (unsigned char)((litlen < 15 ? litlen : 15) << 4);
+    if (litlen >= 15) {
+      for (n = litlen - 15; n >= 255; n -= 255) {
+        dst[op++] = 255;
+      }
+      dst[op++] = (unsigned char)n;
+    }
+    memcpy(dst + op, src + anchor, litlen);
+    op += litlen;
+    return op;
+  }
+
+  /* Writes the staged bytes out as one LZ4 frame block: a 4-byte
+   * little-endian size (high bit set = stored uncompressed) followed by
+   * the data.  Callers hold the output lock with CLOG_THREAD_SAFE. */
+  void _clog_z_flush(struct clog* logger)
+  {
+    unsigned char szb[4];
+    const char* data;
+    unsigned long sz;
+    size_t csize;
+    size_t nbytes;
+    int result;
+
+    if (logger->z_len == 0) {
+      return;
+    }
+    csize = _clog_lz4_compress((const unsigned char*)logger->z_in,
+      logger->z_len, (unsigned char*)logger->z_out,
+      logger->z_cap + logger->z_cap / 255 + 16);
+    if (csize && csize < logger->z_len) {
+      data = logger->z_out;
+      nbytes = csize;
+      sz = (unsigned long)csize;
+    }
+    else {
+      /* Incompressible (or pathological) batch: store it raw. */
+      data = logger->z_in;
+      nbytes = logger->z_len;
+      sz = (unsigned long)logger->z_len | 0x80000000ul;
+    }
+    szb[0] = (unsigned char)(sz & 0xff);
+    szb[1] = (unsigned char)((sz >> 8) & 0xff);
+    szb[2] = (unsigned char)((sz >> 16) & 0xff);
+    szb[3] = (unsigned char)((sz >> 24) & 0xff);
+    result = POSIX_WRITE(logger->fd, szb, 4);
+    if (result != -1) {
+      result = POSIX_WRITE(logger->fd, data, nbytes);
+    }
+    if (result == -1) {
+      _clog_err("Unable to write to log file: %s\n", strerror(errno));
+    }
+    logger->z_len = 0;
+    logger->last_flush_ms = _clog_now_ms();
+  }
+
+  /* Batches one message into the staging block.  Callers hold the output
+   * lock with CLOG_THREAD_SAFE. */
+  void _clog_z_append(struct clog* logger, const char* message, size_t len,
+      enum clog_level level)
+  {
+    size_t chunk;
+
+    while (len) {
+      chunk = logger->z_cap - logger->z_len;
+      if (chunk > len) {
+        chunk = len;
+      }
+      memcpy(logger->z_in + logger->z_len, message, chunk);
+      logger->z_len += chunk;
+      message += chunk;
+      len -= chunk;
+      if (logger->z_len == logger->z_cap) {
+        _clog_z_flush(logger);
+      }
+    }
+    if (level == LEVEL_ERROR ||
+        (logger->flush_interval_ms > 0 &&
+         _clog_now_ms() - logger->last_flush_ms >=
+         logger->flush_interval_ms)) {
+      _clog_z_flush(logger);
+    }
+  }
+
+  int clog_init_file_compressed(const char* const path)
+  {
+    /* Magic plus frame descriptor: version 01, independent blocks, no
+     * checksums; the BD byte declares the maximum block size and the last
+     * byte is the descriptor's xxHash32 header checksum. */
+    unsigned char hdr[7] = { 0x04, 0x22, 0x4d, 0x18, 0x60, 0x40, 0 };
+    char* in;
+    char* out;
+    int fd;
+
+#if CLOG_COMPRESS_BLOCK > 1048576
+    hdr[5] = 0x70;
+#elif CLOG_COMPRESS_BLOCK > 262144
+    hdr[5] = 0x60;
+#elif CLOG_COMPRESS_BLOCK > 65536
+    hdr[5] = 0x50;
+#endif
+    hdr[6] = (unsigned char)(_clog_xxh32(hdr + 4, 2, 0) >> 8);
+    fd = POSIX_OPEN(path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (fd == -1) {
+      _clog_err("Unable to open %s: %s\n", path, strerror(errno));
+      return 1;
+    }
+    in = (char*)malloc(CLOG_COMPRESS_BLOCK);
+    out = (char*)malloc(CLOG_COMPRESS_BLOCK + CLOG_COMPRESS_BLOCK / 255 + 16);
+    if (in == NULL || out == NULL) {
+      _clog_err("Unable to allocate compression buffers\n");
+      free(in);
+      free(out);
+      POSIX_CLOSE(fd);
+      return 1;
+    }
+    if (POSIX_WRITE(fd, hdr, 7) != 7) {
+      _clog_err("Unable to write to %s: %s\n", path, strerror(errno));
+      free(in);
+      free(out);
+      POSIX_CLOSE(fd);
+      return 1;
+    }
+    _clog_logger.z_in = in;
+    _clog_logger.z_len = 0;
+    _clog_logger.z_cap = CLOG_COMPRESS_BLOCK;
+    _clog_logger.z_out = out;
+    _clog_logger.flush_interval_ms = CLOG_COMPRESS_FLUSH_MS;
+    _clog_logger.last_flush_ms = _clog_now_ms();
+    _clog_logger.fd = fd;
+    _clog_logger.fun = NULL;
+    return 0;
+  }
+#endif /* CLOG_COMPRESS_SUPPORT */
+
+#ifdef CLOG_FILE_SUPPORT
+  /* Shifts the rotated files up by one, swaps a fresh fd in and keeps
+   * logging; called from the write path when the size threshold is crossed.
+   * If the new file cannot be opened, the old fd stays in place and another
+   * rotation is attempted after the next max_bytes. */
+  void _clog_rotate(struct clog* logger)
+  {
+    char oldpath[CLOG_PATH_LENGTH + 16];
+    char newpath[CLOG_PATH_LENGTH + 16];
+    int oldfd;
+    int fd;
+    int i;
+    int flags = O_CREAT | O_WRONLY | O_APPEND;
+
+    _clog_file_flush();
+    for (i = logger->rot_max_files - 1; i >= 1; --i) {
+      if (i == 1) {
+        snprintf(oldpath, sizeof(oldpath), "%s", logger->rot_path);
+      }
+      else {
+        snprintf(oldpath, sizeof(oldpath), "%s.%d", logger->rot_path, i - 1);
+      }
+      snprintf(newpath, sizeof(newpath), "%s.%d", logger->rot_path, i);
+      /* Older generations may not exist yet; that is fine. */
+      rename(oldpath, newpath);
+    }
+    if (logger->rot_max_files <= 1) {
+      /* Nothing to keep: start the single file over. */
+      flags |= O_TRUNC;
+    }
+    fd = POSIX_OPEN(logger->rot_path, flags, 0666);
+    logger->rot_written = 0;
+    if (fd == -1) {
+      _clog_err("Unable to reopen %s: %s\n", logger->rot_path,
+        strerror(errno));
+      return;
+    }
+    oldfd = logger->fd;
+    logger->fd = fd;
+    POSIX_CLOSE(oldfd);
+  }
+#endif /* CLOG_FILE_SUPPORT */
+
+  int clog_init_file_rotating(const char* const path, size_t max_bytes,
+      int max_files)
+  {
+#ifdef CLOG_FILE_SUPPORT
+    struct stat st;
+
+    if (strlen(path) >= CLOG_PATH_LENGTH) {
+      _clog_err("Log file path needs to be less than %d characters\n",
+        CLOG_PATH_LENGTH);
+      return 1;
+    }
+    if (clog_init_file(path)) {
+      return 1;
+    }
+    strcpy(_clog_logger.rot_path, path);
+    _clog_logger.rot_max_bytes = max_bytes;
+    _clog_logger.rot_max_files = max_files;
+    /* Count what is already in the file so an existing log rotates on
+     * schedule too. */
+    _clog_logger.rot_written =
+      fstat(_clog_logger.fd, &st) == 0 ? (size_t)st.st_size : 0;
+    return 0;
+#else
+    (void)path;
+    (void)max_bytes;
+    (void)max_files;
+    _clog_logger.fun = NULL;
+    return 0;
+#endif
+  }
+
+  int clog_init_file_buffered(const char* const path, size_t bufsize,
+      long flush_interval_ms)
+  {
+#ifdef CLOG_FILE_SUPPORT
+    char* buf;
+
+    if (clog_init_file(path)) {
+      return 1;
+    }
+    buf = (char*)malloc(bufsize);
+    if (buf == NULL) {
+      _clog_err("Unable to allocate output buffer\n");
+      return 1;
+    }
+
+    _clog_logger.out_buf = buf;
+    _clog_logger.out_len = 0;
+    _clog_logger.out_cap = bufsize;
+    _clog_logger.flush_interval_ms = flush_interval_ms;
+    _clog_logger.last_flush_ms = _clog_now_ms();
+    return 0;
+#else
+    (void)path;
+    (void)bufsize;
+    (void)flush_interval_ms;
+    _clog_logger.fun = NULL;
+    return 0;
+#endif
+  }
+
+  int clog_init_file_shared(const char* const path, size_t bufsize,
+      long flush_interval_ms)
+  {
+#ifdef CLOG_FILE_SUPPORT
+    if (clog_init_file_buffered(path, bufsize, flush_interval_ms)) {
+      return 1;
+    }
+    _clog_logger.shared_chunk = CLOG_SHARED_CHUNK;
+    return 0;
+#else
+    (void)path;
+    (void)bufsize;
+    (void)flush_interval_ms;
+    _clog_logger.fun = NULL;
+    return 0;
+#endif
+  }
+
+  int clog_init_console(int (*fun)(const char* format, ...))
+  {
+    if (fun == NULL)
+    {
+#ifndef CLOG_MULTI_SINK
+      _clog_err("Invalid pointer\n");
+      return 1;
+#endif /* with CLOG_MULTI_SINK a NULL fun is allowed: it silences the
+          regular sink so the sink array is the only destination */
+    }
+#ifdef CLOG_FILE_SUPPORT
+    _clog_logger.fd = 0;
+#endif /* CLOG_FILE_SUPPORT */
+#ifdef CLOG_SOCKET_SUPPORT
+    clog_close_socket();
+#endif /* CLOG_SOCKET_SUPPORT */
+    _clog_logger.fun = fun;
+    return 0;
+  }
+
+#ifdef CLOG_SOCKET_SUPPORT
+  unsigned long _clog_sock_dropped = 0;
+
+  int clog_init_socket(const char* host, int port)
+  {
+    struct addrinfo hints;
+    struct addrinfo* res;
+    struct addrinfo* ai;
+    char portbuf[8];
+    int fd = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    clog_fmt_u64(portbuf, (unsigned long long)port);
+    if (getaddrinfo(host, portbuf, &hints, &res)) {
+      _clog_err("Unable to resolve %s\n", host);
+      return 1;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd == -1) {
+        continue;
+      }
+      /* Connect so plain send() works and the kernel filters for us. */
+      if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        break;
+      }
+      POSIX_CLOSE(fd);
+      fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1) {
+      _clog_err("Unable to reach %s:%d: %s\n", host, port, strerror(errno));
+      return 1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    clog_close_socket();
+    _clog_logger.sock = fd;
+    _clog_sock_dropped = 0;
+#ifdef CLOG_FILE_SUPPORT
+    _clog_logger.fd = 0;
+#endif /* CLOG_FILE_SUPPORT */
+    _clog_logger.fun = NULL;
+    return 0;
+  }
+
+  void clog_close_socket(void)
+  {
+    if (_clog_logger.sock) {
+      POSIX_CLOSE(_clog_logger.sock);
+      _clog_logger.sock = 0;
+    }
+  }
+
+  unsigned long clog_socket_dropped(void)
+  {
+#ifdef CLOG_THREAD_SAFE
+    return __atomic_load_n(&_clog_sock_dropped, __ATOMIC_RELAXED);
+#else
+    return _clog_sock_dropped;
+#endif /* CLOG_THREAD_SAFE */
+  }
+#endif /* CLOG_SOCKET_SUPPORT */
+
+  void clog_close_file(void)
+  {
+#ifdef CLOG_FILE_SUPPORT
+    if (_clog_logger.fd)
+    {
+#ifdef CLOG_MMAP_SUPPORT
+      if (_clog_logger.map)
+      {
+        /* Trim the preallocated tail back to what was actually logged. */
+        munmap(_clog_logger.map, _clog_logger.map_size);
+        if (ftruncate(_clog_logger.fd, (off_t)_clog_logger.map_off) == -1) {
+          _clog_err("Unable to trim log file: %s\n", strerror(errno));
+        }
+        _clog_logger.map = NULL;
+        _clog_logger.map_size = 0;
+        _clog_logger.map_off = 0;
+      }
+#endif /* CLOG_MMAP_SUPPORT */
+#ifdef CLOG_COMPRESS_SUPPORT
+      if (_clog_logger.z_in) {
+        unsigned char endmark[4] = { 0, 0, 0, 0 };
+
+        /* Flush the partial batch and finalize the frame with its end
+         * mark; without it decoders see a truncated file. */
+        _CLOG_OUT_LOCK();
+        _clog_z_flush(&_clog_logger);
+        _CLOG_OUT_UNLOCK();
+        if (POSIX_WRITE(_clog_logger.fd, endmark, 4) != 4) {
+          _clog_err("Unable to write to log file: %s\n", strerror(errno));
+        }
+        free(_clog_logger.z_in);
+        free(_clog_logger.z_out);
+        _clog_logger.z_in = NULL;
+        _clog_logger.z_out = NULL;
+        _clog_logger.z_len = 0;
+        _clog_logger.z_cap = 0;
+        _clog_logger.flush_interval_ms = 0;
+      }
+#endif /* CLOG_COMPRESS_SUPPORT */
+#ifdef CLOG_DIRECT_SUPPORT
+      if (_clog_logger.dio_buf) {
+        /* Write the tail out one last time, then trim the zero padding so
+         * the file ends exactly at the last message. */
+        _CLOG_OUT_LOCK();
+        _clog_dio_flush(&_clog_logger);
+        _CLOG_OUT_UNLOCK();
+        if (ftruncate(_clog_logger.fd,
+            (off_t)(_clog_logger.dio_base + _clog_logger.dio_len)) == -1) {
+          _clog_err("Unable to trim log file: %s\n", strerror(errno));
+        }
+        free(_clog_logger.dio_buf);
+        _clog_logger.dio_buf = NULL;
+        _clog_logger.dio_len = 0;
+        _clog_logger.dio_cap = 0;
+        _clog_logger.dio_block = 0;
+        _clog_logger.dio_base = 0;
+      }
+      _clog_logger.sync_bytes = 0;
+      _clog_logger.sync_interval_ms = 0;
+      _clog_logger.sync_on_error = 0;
+      _clog_logger.sync_pending = 0;
+#endif /* CLOG_DIRECT_SUPPORT */
+      _CLOG_OUT_LOCK();
+      _clog_file_flush();
+      _CLOG_OUT_UNLOCK();
+      POSIX_CLOSE(_clog_logger.fd);
+      _clog_logger.fd = 0;
+    }
+    if (_clog_logger.out_buf)
+    {
+      free(_clog_logger.out_buf);
+      _clog_logger.out_buf = NULL;
+      _clog_logger.out_cap = 0;
+      _clog_logger.shared_chunk = 0;
+    }
+    _clog_logger.rot_max_bytes = 0;
+    _clog_logger.rot_written = 0;
+#endif
+  }
+
+  /* Internal functions */
+
+  /* Pairs "00".."99", so decimal rendering peels two digits per division. */
+  const char _clog_digits100[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+  size_t clog_fmt_u64(char* dst, unsigned long long v)
+  {
+    char tmp[20];
+    char* p = tmp + 20;
+    size_t n;
+
+    while (v >= 100) {
+      unsigned int r = (unsigned int)(v % 100);
+      v /= 100;
+      p -= 2;
+      memcpy(p, _clog_digits100 + r * 2, 2);
+    }
+    if (v >= 10) {
+      p -= 2;
+      memcpy(p, _clog_digits100 + (unsigned int)v * 2, 2);
+    }
+    else {
+      *--p = (char)('0' + (unsigned int)v);
+    }
+    n = (size_t)(tmp + 20 - p);
+    memcpy(dst, p, n);
+    dst[n] = 0;
+    return n;
+  }
+
+  size_t clog_fmt_hex(char* dst, unsigned long long v)
+  {
+    const char* hexdig = "0123456789abcdef";
+    char tmp[16];
+    char* p = tmp + 16;
+    size_t n;
+
+    do {
+      *--p = hexdig[v & 0xf];
+      v >>= 4;
+    } while (v);
+    n = (size_t)(tmp + 16 - p);
+    memcpy(dst, p, n);
+    dst[n] = 0;
+    return n;
+  }
+
+  /* Signed wrapper for the %n / %h fields. */
+  size_t _clog_fmt_long(char* dst, long v)
+  {
+    if (v < 0) {
+      dst[0] = '-';
+      return 1 + clog_fmt_u64(dst + 1, 0ull - (unsigned long long)v);
+    }
+    return clog_fmt_u64(dst, (unsigned long long)v);
+  }
+
+  /* An output line under construction.  It starts in the caller's stack
+   * buffer and moves to the heap only when the line outgrows it.  The current
+   * length is tracked so appends never rescan the buffer. */
+  struct _clog_builder {
+    char* buf;    /* Current buffer (stack or heap). */
+    char* orig;   /* The caller-provided stack buffer. */
+    size_t len;   /* Bytes used, excluding the terminator. */
+    size_t cap;   /* Total capacity of buf. */
+  };
+
+  void _clog_builder_init(struct _clog_builder* b, char* buf, size_t cap)
+  {
+    b->buf = buf;
+    b->orig = buf;
+    b->len = 0;
+    b->cap = cap;
+    buf[0] = 0;
+  }
+
+  void _clog_builder_reserve(struct _clog_builder* b, size_t extra)
+  {
+    size_t new_cap = b->cap;
+
+    while (b->len + extra >= new_cap) {
+      new_cap *= 2;
+    }
+    if (new_cap != b->cap) {
+      if (b->buf == b->orig) {
+        b->buf = (char*)malloc(new_cap);
+        memcpy(b->buf, b->orig, b->len + 1);
+      }
+      else {
+        b->buf = (char*)realloc(b->buf, new_cap);
+      }
+      b->cap = new_cap;
+    }
+  }
+
+  void _clog_append_mem(struct _clog_builder* b, const char* src, size_t n)
+  {
+    _clog_builder_reserve(b, n + 1);
+    memcpy(b->buf + b->len, src, n);
+    b->len += n;
+    b->buf[b->len] = 0;
+  }
+
+  void _clog_append_str(struct _clog_builder* b, const char* src)
+  {
+    _clog_append_mem(b, src, strlen(src));
+  }
+
+  void _clog_append_int(struct _clog_builder* b, long int d)
+  {
+    char buf[24];
+
+    _clog_append_mem(b, buf, _clog_fmt_long(buf, d));
+  }
+
+#ifdef CLOG_TIME_SUPPORT
+  /* Prebuilt date/time strings for the current epoch second.  localtime()
+   * (which takes a lock in glibc) and strftime() run only when the second
+   * changes; within a second %d and %t are a plain memcpy.  Sub-second
+   * precision comes from the %h tick value, which stays on the integer
+   * path. */
+  CLOG_THREAD_LOCAL struct {
+    time_t second;
+    char date[CLOG_DATETIME_LENGTH];
+    size_t date_len;
+    char time[CLOG_DATETIME_LENGTH];
+    size_t time_len;
+  } _clog_tcache = { (time_t)-1, { 0 }, 0, { 0 }, 0 };
+
+  void _clog_tcache_refresh(const struct clog* logger, time_t t)
+  {
+    struct tm* lt = localtime(&t);
+
+    _clog_tcache.date_len = strftime(_clog_tcache.date,
+      CLOG_DATETIME_LENGTH, logger->date_fmt, lt);
+    _clog_tcache.time_len = strftime(_clog_tcache.time,
+      CLOG_DATETIME_LENGTH, logger->time_fmt, lt);
+    _clog_tcache.second = t;
+  }
+#endif /* CLOG_TIME_SUPPORT */
+
+
+  const char* _clog_basename(const char* path)
+  {
+    const char* slash = strrchr(path, '/');
+    if (slash) {
+      path = slash + 1;
+    }
+#ifdef _WIN32
+    slash = strrchr(path, '\\');
+    if (slash) {
+      path = slash + 1;
+    }
+#endif
+    return path;
+  }
+
+#ifdef CLOG_RING_SUPPORT
+
+/* Number of records the flight recorder retains; must be a power of two. */
+#ifndef CLOG_RING_SIZE
+#define CLOG_RING_SIZE 1024
+#endif
+
+/* Message bodies longer than this are truncated in the ring. */
+#ifndef CLOG_RING_MSG_LENGTH
+#define CLOG_RING_MSG_LENGTH 256
+#endif
+
+  /* One retained message.  seq doubles as the publish marker: a slot is
+   * valid for position pos once seq == pos + 1, so clog_dump_ring can skip
+   * slots that were never written or that a crashed thread left half
+   * filled. */
+  struct _clog_ring_slot {
+    unsigned long seq;
+    const char* sfile;
+    int sline;
+    const char* sfunction;
+    clog_control_block_t* smodule;
+    enum clog_level level;
+#ifdef CLOG_TIME_SUPPORT
+    time_t when;
+    clock_t ticks;
+#endif /* CLOG_TIME_SUPPORT */
+    char text[CLOG_RING_MSG_LENGTH];
+  };
+
+  /* All static so a crash handler can dump without ever having allocated. */
+  struct _clog_ring_slot _clog_ring_slots[CLOG_RING_SIZE];
+  unsigned long _clog_ring_head;
+  int _clog_ring_active;
+  int _clog_ring_dumping;
+#ifdef CLOG_TIME_SUPPORT
+  time_t _clog_ring_when;
+  clock_t _clog_ring_ticks;
+#endif /* CLOG_TIME_SUPPORT */
+
+  void clog_init_ring(void)
+  {
+    _clog_ring_active = 1;
+  }
+
+  /* Captures one accepted message into the ring.  Slot claiming is a single
+   * increment; two threads more than a full lap apart can race on the same
+   * slot, which at worst tears one record - the publish marker keeps a torn
+   * record out of the dump, an acceptable trade for a post-mortem aid. */
+  void _clog_ring_capture(const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level, const char* fmt,
+      va_list ap)
+  {
+    struct _clog_ring_slot* slot;
+    unsigned long pos;
+
+#ifdef CLOG_THREAD_SAFE
+    pos = __atomic_fetch_add(&_clog_ring_head, 1, __ATOMIC_RELAXED);
+#else
+    pos = _clog_ring_head++;
+#endif /* CLOG_THREAD_SAFE */
+    slot = &_clog_ring_slots[pos & (CLOG_RING_SIZE - 1)];
+    slot->sfile = sfile;
+    slot->sline = sline;
+    slot->sfunction = sfunction;
+    slot->smodule = smodule;
+    slot->level = level;
+#ifdef CLOG_TIME_SUPPORT
+    slot->when = time(NULL);
+    slot->ticks = clock();
+#endif /* CLOG_TIME_SUPPORT */
+    vsnprintf(slot->text, CLOG_RING_MSG_LENGTH, fmt, ap);
+#ifdef CLOG_THREAD_SAFE
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+#else
+    slot->seq = pos + 1;
+#endif /* CLOG_THREAD_SAFE */
+  }
+
+#endif /* CLOG_RING_SUPPORT */
+
+  /* Compiles logger->fmt into the token array.  Each token carries the
+   * literal run preceding a specifier; the final token may be literal-only.
+   * Returns zero on success. */
+  int _clog_compile_format(struct clog* logger)
+  {
+    const char* fmt = logger->fmt;
+    const char* pct;
+    int n = 0;
+
+    while (*fmt) {
+      if (n >= CLOG_FORMAT_TOKENS) {
+        return 1;
+      }
+      pct = strchr(fmt, '%');
+      logger->tokens[n].lit = fmt;
+      if (pct == NULL) {
+        /* Trailing literal run. */
+        logger->tokens[n].lit_len = strlen(fmt);
+        logger->tokens[n].spec = 0;
+        ++n;
+        break;
+      }
+      logger->tokens[n].lit_len = (size_t)(pct - fmt);
+      logger->tokens[n].spec = pct[1];
+      if (pct[1] == 0) {
+        /* Dangling '%' at end of format: drop it, as before. */
+        logger->tokens[n].spec = 0;
+        ++n;
+        break;
+      }
+      ++n;
+      fmt = pct + 2;
+    }
+    if (n == 0) {
+      /* Empty format: keep one literal-only token so we don't recompile. */
+      logger->tokens[0].lit = fmt;
+      logger->tokens[0].lit_len = 0;
+      logger->tokens[0].spec = 0;
+      n = 1;
+    }
+    logger->ntokens = n;
+    return 0;
+  }
+
+  /* Backing store for a caller-supplied format; logger->fmt points at the
+   * default literal until clog_set_format() fills this.  Kept out of the
+   * logger struct so the struct stays a few constant-initialized words. */
+  char _clog_fmt_store[CLOG_FORMAT_LENGTH];
+
+  int clog_set_format(const char* fmt)
+  {
+    struct clog* logger = &_clog_logger;
+    char old_store[CLOG_FORMAT_LENGTH];
+    const char* old_fmt = logger->fmt;
+
+    if (strlen(fmt) >= CLOG_FORMAT_LENGTH) {
+      _clog_err("Format specifier needs to be less than %d characters\n",
+        CLOG_FORMAT_LENGTH);
+      return 1;
+    }
+    memcpy(old_store, _clog_fmt_store, CLOG_FORMAT_LENGTH);
+    strcpy(_clog_fmt_store, fmt);
+    logger->fmt = _clog_fmt_store;
+    logger->ntokens = 0;
+    if (_clog_compile_format(logger)) {
+      /* A rejected format must leave the previous one in effect.  The old
+       * tokens pointed into the bytes just overwritten, so put the backing
+       * store back and recompile the old format (which compiled before). */
+      memcpy(_clog_fmt_store, old_store, CLOG_FORMAT_LENGTH);
+      logger->fmt = old_fmt;
+      logger->ntokens = 0;
+      _clog_compile_format(logger);
+      _clog_err("Format specifier has too many tokens\n");
+      return 1;
+    }
+    return 0;
+  }
+
+  char*  _clog_format(struct clog* logger, char buf[], size_t buf_size,
+      const char* sfile, int sline, const char* sfunction,
+      const char* smodule, const char* level, const char* message)
+  {
+    struct _clog_builder b;
+    const struct clog_fmt_token* tok;
+    int i;
+#ifdef CLOG_TIME_SUPPORT
+    time_t t = time(NULL);
+    clock_t ticks = clock();
+
+#ifdef CLOG_RING_SUPPORT
+    /* A dump renders with the capture-time clock, not the current one. */
+    if (_clog_ring_dumping) {
+      t = _clog_ring_when;
+      ticks = _clog_ring_ticks;
+    }
+#endif /* CLOG_RING_SUPPORT */
+    if (t != _clog_tcache.second) {
+      _clog_tcache_refresh(logger, t);
+    }
+#endif /* CLOG_TIME_SUPPORT */
+
+    if (logger->ntokens == 0) {
+      _clog_compile_format(logger);
+    }
+
+    _clog_builder_init(&b, buf, buf_size);
+    for (i = 0; i < logger->ntokens; ++i) {
+      tok = &logger->tokens[i];
+      if (tok->lit_len) {
+        _clog_append_mem(&b, tok->lit, tok->lit_len);
+      }
+      switch (tok->spec) {
+      case 0:
+        break;
+      case '%':
+        _clog_append_mem(&b, "%", 1);
+        break;
+#ifdef CLOG_TIME_SUPPORT
+      case 't':
+        _clog_append_mem(&b, _clog_tcache.time, _clog_tcache.time_len);
+        break;
+      case 'd':
+        _clog_append_mem(&b, _clog_tcache.date, _clog_tcache.date_len);
+        break;
+      case 'h':
+        _clog_append_int(&b, ticks);
+        break;
+#endif /* CLOG_TIME_SUPPORT */
+      case 'l':
+        _clog_append_str(&b, level);
+        break;
+      case 'e':
+        _clog_append_str(&b, smodule);
+        break;
+      case 'g':
+        _clog_append_str(&b, sfunction);
+        break;
+      case 'n':
+        _clog_append_int(&b, sline);
+        break;
+      case 'f':
+        _clog_append_str(&b, sfile);
+        break;
+      case 'm':
+        _clog_append_str(&b, message);
+        break;
+      }
+    }
+
+    return b.buf;
+  }
+
+#ifdef CLOG_WRITEV_SUPPORT
+  /* Emits one message as a single writev straight from the compiled format
+   * tokens: literal spans, the cached date/time, the level/module strings
+   * and the message body go out as iovec entries, so the line is never
+   * assembled into a contiguous buffer first.  Returns non-zero when the
+   * message cannot be emitted this way (too many numeric fields) and the
+   * caller should fall back to the copying path. */
+  int _clog_emit_writev(struct clog* logger, const char* sfile, int sline,
+      const char* sfunction, clog_control_block_t* smodule,
+      enum clog_level level, const char* text)
+  {
+    struct iovec iov[2 * CLOG_FORMAT_TOKENS];
+    char numbuf[8][24];
+    const struct clog_fmt_token* tok;
+    int nnum = 0;
+    int n = 0;
+    int i;
+#ifdef CLOG_TIME_SUPPORT
+    time_t t = time(NULL);
+    clock_t ticks = clock();
+
+    if (t != _clog_tcache.second) {
+      _clog_tcache_refresh(logger, t);
+    }
+#endif /* CLOG_TIME_SUPPORT */
+
+    if (logger->ntokens == 0) {
+      _clog_compile_format(logger);
+    }
+
+#define _CLOG_IOV(ptr, n_bytes) \
+    do { \
+      iov[n].iov_base = (void*)(ptr); \
+      iov[n].iov_len = (n_bytes); \
+      ++n; \
+    } while (0)
+
+    for (i = 0; i < logger->ntokens; ++i) {
+      tok = &logger->tokens[i];
+      if (tok->lit_len) {
+        _CLOG_IOV(tok->lit, tok->lit_len);
+      }
+      switch (tok->spec) {
+      case 0:
+        break;
+      case '%':
+        _CLOG_IOV("%", 1);
+        break;
+#ifdef CLOG_TIME_SUPPORT
+      case 't':
+        _CLOG_IOV(_clog_tcache.time, _clog_tcache.time_len);
+        break;
+      case 'd':
+        _CLOG_IOV(_clog_tcache.date, _clog_tcache.date_len);
+        break;
+      case 'h':
+        if (nnum >= 8) {
+          return 1;
+        }
+        _CLOG_IOV(numbuf[nnum], _clog_fmt_long(numbuf[nnum], (long)ticks));
+        ++nnum;
+        break;
+#endif /* CLOG_TIME_SUPPORT */
+      case 'l':
+        _CLOG_IOV(level < LEVEL_NONE ? CLOG_LEVEL_NAMES[level] : "?",
+          strlen(level < LEVEL_NONE ? CLOG_LEVEL_NAMES[level] : "?"));
+        break;
+      case 'e':
+        _CLOG_IOV(smodule->module_name, strlen(smodule->module_name));
+        break;
+      case 'g':
+        _CLOG_IOV(sfunction, strlen(sfunction));
+        break;
+      case 'n':
+        if (nnum >= 8) {
+          return 1;
+        }
+        _CLOG_IOV(numbuf[nnum], _clog_fmt_long(numbuf[nnum], (long)sline));
+        ++nnum;
+        break;
+      case 'f':
+        _CLOG_IOV(sfile, strlen(sfile));
+        break;
+      case 'm':
+        _CLOG_IOV(text, strlen(text));
+        break;
+      }
+    }
+
+#undef _CLOG_IOV
+
+    {
+      ssize_t written = writev(logger->fd, iov, n);
+      if (written == -1) {
+        _clog_err("Unable to write to log file: %s\n", strerror(errno));
+      }
+      else {
+        _CLOG_STAT_ADD(smodule->bytes, (unsigned long)written);
+      }
+      if (written != -1 && logger->rot_max_bytes) {
+        _CLOG_OUT_LOCK();
+        logger->rot_written += (size_t)written;
+        if (logger->rot_written >= logger->rot_max_bytes) {
+          _clog_rotate(logger);
+        }
+        _CLOG_OUT_UNLOCK();
+      }
+    }
+    return 0;
+  }
+#endif /* CLOG_WRITEV_SUPPORT */
+
+  /* Hands one finished line to whichever sink is configured.  Shared by the
+   * formatted path (_clog_emit) and the structured path (_clog_log_kv),
+   * which build their lines differently but deliver them the same way. */
+  void _clog_deliver(clog_control_block_t* smodule, enum clog_level level,
+      const char* message, size_t len)
+  {
+    int result = 0;
+    struct clog* logger = &_clog_logger;
+
+    _CLOG_STAT_ADD(smodule->bytes, len);
+
+#if !defined(CLOG_FILE_SUPPORT) && !defined(CLOG_MULTI_SINK)
+    /* Neither the console path nor the socket path looks at the level. */
+    (void) level;
+#endif
+
+#ifdef CLOG_FILE_SUPPORT
+    if (logger->fd)
+    {
+#ifdef CLOG_COMPRESS_SUPPORT
+      if (logger->z_in) {
+        _CLOG_OUT_LOCK();
+        _clog_z_append(logger, message, len, level);
+        _CLOG_OUT_UNLOCK();
+      }
+      else
+#endif /* CLOG_COMPRESS_SUPPORT */
+#ifdef CLOG_DIRECT_SUPPORT
+      if (logger->dio_buf) {
+        _CLOG_OUT_LOCK();
+        _clog_dio_append(logger, message, len);
+        _CLOG_OUT_UNLOCK();
+      }
+      else
+#endif /* CLOG_DIRECT_SUPPORT */
+#ifdef CLOG_MMAP_SUPPORT
+      if (logger->map) {
+        _CLOG_OUT_LOCK();
+        _clog_mmap_append(logger, message, len);
+        _CLOG_OUT_UNLOCK();
+      }
+      else
+#endif /* CLOG_MMAP_SUPPORT */
+      if (logger->out_buf) {
+        /* Batch into the output buffer; oversized messages go out directly
+         * behind whatever is already queued. */
+        _CLOG_OUT_LOCK();
+        if (logger->out_len + len > logger->out_cap) {
+          _CLOG_STAT_ADD(smodule->flush_stalls, 1);
+          _clog_file_flush();
+        }
+        if (len > logger->out_cap) {
+          result = POSIX_WRITE(logger->fd, message, len);
+        }
+        else {
+          memcpy(logger->out_buf + logger->out_len, message, len);
+          logger->out_len += len;
+          if (level == LEVEL_ERROR ||
+              (logger->flush_interval_ms > 0 &&
+               _clog_now_ms() - logger->last_flush_ms >=
+               logger->flush_interval_ms)) {
+            _clog_file_flush();
+          }
+        }
+        _CLOG_OUT_UNLOCK();
+      }
+      else {
+        result = POSIX_WRITE(logger->fd, message, len);
+      }
+      if (logger->rot_max_bytes) {
+        _CLOG_OUT_LOCK();
+        logger->rot_written += len;
+        if (logger->rot_written >= logger->rot_max_bytes) {
+          _clog_rotate(logger);
+        }
+        _CLOG_OUT_UNLOCK();
+      }
+#ifdef CLOG_DIRECT_SUPPORT
+      _clog_maybe_sync(logger, level, len);
+#endif /* CLOG_DIRECT_SUPPORT */
+    }
+    else
+#endif
+#ifdef CLOG_SOCKET_SUPPORT
+    if (logger->sock)
+    {
+      /* One message per datagram, never blocking: if the send cannot
+       * complete right now (or the collector is gone) the message is
+       * dropped and counted, not retried. */
+      if (send(logger->sock, message, len, 0) == -1) {
+        _CLOG_STAT_ADD(smodule->dropped, 1);
+#ifdef CLOG_THREAD_SAFE
+        __atomic_fetch_add(&_clog_sock_dropped, 1, __ATOMIC_RELAXED);
+#else
+        ++_clog_sock_dropped;
+#endif /* CLOG_THREAD_SAFE */
+      }
+    }
+    else
+#endif /* CLOG_SOCKET_SUPPORT */
+    if (logger->fun)
+    {
+      result = logger->fun(message);
+    }
+
+#ifdef CLOG_MULTI_SINK
+    if (_clog_nsinks) {
+      int i;
+
+      _CLOG_OUT_LOCK();
+      for (i = 0; i < _clog_nsinks; ++i) {
+        if (level >= _clog_sinks[i].min_level) {
+          _clog_sink_deliver(&_clog_sinks[i], level, message, len);
+        }
+      }
+      _CLOG_OUT_UNLOCK();
+    }
+#endif /* CLOG_MULTI_SINK */
+
+    if (result == -1) {
+      _clog_err("Unable to write to log file: %s\n", strerror(errno));
+    }
+  }
+
+  /* Formats a finished message body according to the log format and hands it
+   * to the configured sink.  Runs on the calling thread in synchronous mode
+   * and on the flusher thread with CLOG_ASYNC. */
+  void  _clog_emit(const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level, const char* text)
+  {
+    /* With CLOG_THREAD_SAFE this scratch space lives in thread-local storage
+     * instead of the stack, so every thread reuses its own arena. */
+    static CLOG_THREAD_LOCAL char message_buf[4096];
+    char* message;
+    size_t len;
+    struct clog* logger = &_clog_logger;
+
+#ifdef CLOG_WRITEV_SUPPORT
+    /* The plain fd sink can scatter-gather; the buffered and mapped sinks
+     * still need the assembled line, and so does the sink array. */
+    if (logger->fd && !logger->out_buf
+#ifdef CLOG_MMAP_SUPPORT
+        && !logger->map
+#endif /* CLOG_MMAP_SUPPORT */
+#ifdef CLOG_DIRECT_SUPPORT
+        && !logger->dio_buf
+#endif /* CLOG_DIRECT_SUPPORT */
+#ifdef CLOG_COMPRESS_SUPPORT
+        && !logger->z_in
+#endif /* CLOG_COMPRESS_SUPPORT */
+#ifdef CLOG_MULTI_SINK
+        && _clog_nsinks == 0
+#endif /* CLOG_MULTI_SINK */
+       ) {
+      if (_clog_emit_writev(logger, sfile, sline, sfunction, smodule, level,
+          text) == 0) {
+#ifdef CLOG_DIRECT_SUPPORT
+        /* The body length undercounts the prefix; the cadence is
+         * approximate anyway. */
+        _clog_maybe_sync(logger, level, strlen(text));
+#endif /* CLOG_DIRECT_SUPPORT */
+        return;
+      }
+    }
+#endif /* CLOG_WRITEV_SUPPORT */
+
+    message = _clog_format(logger, message_buf, 4096, sfile, sline, sfunction,
+      smodule->module_name, CLOG_LEVEL_NAMES[level], text);
+    if (!message) {
+      _clog_err("Formatting failed (2).\n");
+      return;
+    }
+    len = strlen(message);
+    _clog_deliver(smodule, level, message, len);
+    if (message != message_buf) {
+      free(message);
+    }
+  }
+
+#ifdef CLOG_RING_SUPPORT
+  int clog_dump_ring(int fd)
+  {
+    char line_buf[4096];
+    char* line;
+    struct _clog_ring_slot* slot;
+    struct clog* logger = &_clog_logger;
+    unsigned long head;
+    unsigned long pos;
+    int result;
+    int ndumped = 0;
+
+#ifdef CLOG_THREAD_SAFE
+    head = __atomic_load_n(&_clog_ring_head, __ATOMIC_ACQUIRE);
+#else
+    head = _clog_ring_head;
+#endif /* CLOG_THREAD_SAFE */
+    pos = head > CLOG_RING_SIZE ? head - CLOG_RING_SIZE : 0;
+    for (; pos != head; ++pos) {
+      slot = &_clog_ring_slots[pos & (CLOG_RING_SIZE - 1)];
+#ifdef CLOG_THREAD_SAFE
+      if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+#else
+      if (slot->seq != pos + 1) {
+#endif /* CLOG_THREAD_SAFE */
+        /* Never written, overwritten meanwhile, or torn by the crash. */
+        continue;
+      }
+#ifdef CLOG_TIME_SUPPORT
+      _clog_ring_when = slot->when;
+      _clog_ring_ticks = slot->ticks;
+#endif /* CLOG_TIME_SUPPORT */
+      _clog_ring_dumping = 1;
+      line = _clog_format(logger, line_buf, 4096, slot->sfile, slot->sline,
+        slot->sfunction, slot->smodule->module_name,
+        CLOG_LEVEL_NAMES[slot->level],
+        slot->text);
+      _clog_ring_dumping = 0;
+      if (!line) {
+        continue;
+      }
+      result = POSIX_WRITE(fd, line, strlen(line));
+      if (line != line_buf) {
+        free(line);
+      }
+      if (result == -1) {
+        return -1;
+      }
+      ++ndumped;
+    }
+    return ndumped;
+  }
+#endif /* CLOG_RING_SUPPORT */
+
+#ifdef CLOG_BINARY
+
+  /* One binary record under construction.  The first 8 bytes are reserved
+   * for the header and patched in by _clog_bin_finish. */
+  struct _clog_bin_writer {
+    unsigned char buf[CLOG_BIN_RECORD_LENGTH];
+    size_t len;
+    int overflow;
+  };
+
+  unsigned short _clog_bin_nsites = 0;
+
+  void _clog_bin_begin(struct _clog_bin_writer* w)
+  {
+    w->len = 8;
+    w->overflow = 0;
+  }
+
+  void _clog_bin_put(struct _clog_bin_writer* w, const void* p, size_t n)
+  {
+    if (w->len + n > CLOG_BIN_RECORD_LENGTH) {
+      w->overflow = 1;
+      return;
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+  }
+
+  void _clog_bin_put_u32(struct _clog_bin_writer* w, unsigned int v)
+  {
+    _clog_bin_put(w, &v, 4);
+  }
+
+  void _clog_bin_put_u64(struct _clog_bin_writer* w, unsigned long long v)
+  {
+    _clog_bin_put(w, &v, 8);
+  }
+
+  void _clog_bin_put_str(struct _clog_bin_writer* w, const char* s)
+  {
+    _clog_bin_put(w, s, strlen(s) + 1);
+  }
+
+  void _clog_bin_put_tag(struct _clog_bin_writer* w, char tag)
+  {
+    _clog_bin_put(w, &tag, 1);
+  }
+
+  /* Fills in the header and writes the record with a single write call. */
+  void _clog_bin_finish(struct _clog_bin_writer* w, unsigned char type,
+      unsigned char level, unsigned short site)
+  {
+    unsigned int payload;
+
+    if (w->overflow) {
+      _clog_err("Binary record too large, dropped\n");
+      return;
+    }
+    payload = (unsigned int)(w->len - 8);
+    w->buf[0] = type;
+    w->buf[1] = level;
+    memcpy(w->buf + 2, &site, 2);
+    memcpy(w->buf + 4, &payload, 4);
+    if (POSIX_WRITE(_clog_logger.fd, w->buf, w->len) == -1) {
+      _clog_err("Unable to write to log file: %s\n", strerror(errno));
+    }
+  }
+
+  /* Walks the printf format and appends one tagged value per conversion.
+   * Returns non-zero if the format uses something we cannot capture (the
+   * caller then falls back to a pre-rendered text record). */
+  int _clog_bin_capture(struct _clog_bin_writer* w, const char* fmt,
+      va_list ap)
+  {
+    const char* p = fmt;
+    long long iv;
+    unsigned long long uv;
+    double dv;
+    const char* sv;
+    unsigned int sn;
+    int lmod;
+
+    while (*p) {
+      if (*p++ != '%') {
+        continue;
+      }
+      if (*p == '%') {
+        ++p;
+        continue;
+      }
+      while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+        ++p;
+      }
+      if (*p == '*') {
+        return 1;
+      }
+      while (*p >= '0' && *p <= '9') {
+        ++p;
+      }
+      if (*p == '.') {
+        ++p;
+        if (*p == '*') {
+          return 1;
+        }
+        while (*p >= '0' && *p <= '9') {
+          ++p;
+        }
+      }
+      /* Length modifier: 0 = int, 1 = long, 2 = long long, 3 = size_t,
+       * 4 = ptrdiff_t, 5 = intmax_t.  h/hh arrive promoted to int. */
+      lmod = 0;
+      if (*p == 'h') {
+        ++p;
+        if (*p == 'h') {
+          ++p;
+        }
+      }
+      else if (*p == 'l') {
+        ++p;
+        if (*p == 'l') {
+          ++p;
+          lmod = 2;
+        }
+        else {
+          lmod = 1;
+        }
+      }
+      else if (*p == 'z') {
+        ++p;
+        lmod = 3;
+      }
+      else if (*p == 't') {
+        ++p;
+        lmod = 4;
+      }
+      else if (*p == 'j') {
+        ++p;
+        lmod = 5;
+      }
+      else if (*p == 'L') {
+        return 1;
+      }
+      switch (*p++) {
+      case 'd':
+      case 'i':
+        switch (lmod) {
+        case 1:  iv = va_arg(ap, long); break;
+        case 2:  iv = va_arg(ap, long long); break;
+        case 3:  iv = (long long)va_arg(ap, size_t); break;
+        case 4:  iv = (long long)va_arg(ap, ptrdiff_t); break;
+        case 5:  iv = (long long)va_arg(ap, long long); break;
+        default: iv = va_arg(ap, int); break;
+        }
+        _clog_bin_put_tag(w, CLOG_BIN_ARG_INT);
+        _clog_bin_put_u64(w, (unsigned long long)iv);
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        switch (lmod) {
+        case 1:  uv = va_arg(ap, unsigned long); break;
+        case 2:  uv = va_arg(ap, unsigned long long); break;
+        case 3:  uv = (unsigned long long)va_arg(ap, size_t); break;
+        case 4:  uv = (unsigned long long)va_arg(ap, ptrdiff_t); break;
+        case 5:  uv = va_arg(ap, unsigned long long); break;
+        default: uv = va_arg(ap, unsigned int); break;
+        }
+        _clog_bin_put_tag(w, CLOG_BIN_ARG_INT);
+        _clog_bin_put_u64(w, uv);
+        break;
+      case 'c':
+        iv = va_arg(ap, int);
+        _clog_bin_put_tag(w, CLOG_BIN_ARG_INT);
+        _clog_bin_put_u64(w, (unsigned long long)iv);
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        dv = va_arg(ap, double);
+        _clog_bin_put_tag(w, CLOG_BIN_ARG_DBL);
+        _clog_bin_put(w, &dv, 8);
+        break;
+      case 's':
+        sv = va_arg(ap, const char*);
+        if (sv == NULL) {
+          sv = "(null)";
+        }
+        sn = (unsigned int)strlen(sv);
+        if (sn > CLOG_BIN_STR_MAX) {
+          sn = CLOG_BIN_STR_MAX;
+        }
+        _clog_bin_put_tag(w, CLOG_BIN_ARG_STR);
+        _clog_bin_put_u32(w, sn);
+        _clog_bin_put(w, sv, sn);
+        break;
+      case 'p':
+        _clog_bin_put_tag(w, CLOG_BIN_ARG_PTR);
+        _clog_bin_put_u64(w, (unsigned long long)(size_t)va_arg(ap, void*));
+        break;
+      default:
+        return 1;
+      }
+    }
+    return w->overflow;
+  }
+
+  void _clog_log_bin(unsigned short* site_id, const char* sfile, int sline,
+      const char* sfunction, clog_control_block_t* smodule,
+      enum clog_level level, const char* fmt, ...)
+  {
+    struct _clog_bin_writer w;
+    va_list ap;
+    unsigned short id;
+    unsigned long long sec;
+    unsigned long long ticks;
+
+    if (!_clog_logger.fd) {
+      return;
+    }
+
+    id = *site_id;
+    if (id == 0) {
+      /* First message from this site: hand out an ID and describe the site
+       * in the stream.  Two threads racing here emit the record twice under
+       * different IDs, which the decoder handles fine. */
+#ifdef CLOG_THREAD_SAFE
+      id = (unsigned short)__atomic_add_fetch(&_clog_bin_nsites, 1,
+        __ATOMIC_RELAXED);
+#else
+      id = ++_clog_bin_nsites;
+#endif
+      _clog_bin_begin(&w);
+      _clog_bin_put_u32(&w, (unsigned int)sline);
+      _clog_bin_put_str(&w, sfile);
+      _clog_bin_put_str(&w, sfunction);
+      _clog_bin_put_str(&w, smodule->module_name);
+      _clog_bin_put_str(&w, fmt);
+      _clog_bin_finish(&w, CLOG_BIN_SITE, 0, id);
+      _CLOG_STAT_ADD(smodule->bytes, w.len);
+      *site_id = id;
+    }
+
+    sec = (unsigned long long)time(NULL);
+    ticks = (unsigned long long)clock();
+
+    _clog_bin_begin(&w);
+    _clog_bin_put_u64(&w, sec);
+    _clog_bin_put_u64(&w, ticks);
+    va_start(ap, fmt);
+    if (_clog_bin_capture(&w, fmt, ap)) {
+      /* Unsupported conversion somewhere: render the text now instead. */
+      char text[CLOG_BIN_RECORD_LENGTH - 32];
+      va_end(ap);
+      va_start(ap, fmt);
+      vsnprintf(text, sizeof(text), fmt, ap);
+      _clog_bin_begin(&w);
+      _clog_bin_put_u64(&w, sec);
+      _clog_bin_put_u64(&w, ticks);
+      _clog_bin_put_str(&w, text);
+      va_end(ap);
+      _clog_bin_finish(&w, CLOG_BIN_TEXT, (unsigned char)level, id);
+      _CLOG_STAT_ADD(smodule->bytes, w.len);
+      return;
+    }
+    va_end(ap);
+    _clog_bin_finish(&w, CLOG_BIN_MSG, (unsigned char)level, id);
+    _CLOG_STAT_ADD(smodule->bytes, w.len);
+  }
+
+#endif /* CLOG_BINARY */
+
+#ifdef CLOG_ASYNC
+
+/* Number of slots in the ring buffer; must be a power of two. */
+#ifndef CLOG_ASYNC_RING_SIZE
+#define CLOG_ASYNC_RING_SIZE 1024
+#endif
+
+/* Message bodies longer than this are truncated in async mode. */
+#ifndef CLOG_ASYNC_MSG_LENGTH
+#define CLOG_ASYNC_MSG_LENGTH 512
+#endif
+
+  /* One captured log call.  seq is the slot's sequence number in the
+   * multi-producer/single-consumer scheme of Dmitry Vyukov's bounded queue:
+   * seq == pos means the slot is free for the producer that claimed position
+   * pos, seq == pos + 1 means the slot holds a published message. */
+  struct _clog_async_slot {
+    unsigned long seq;
+    const char* sfile;
+    int sline;
+    const char* sfunction;
+    clog_control_block_t* smodule;
+    enum clog_level level;
+    char text[CLOG_ASYNC_MSG_LENGTH];
+  };
+
+  struct _clog_async_slot _clog_async_slots[CLOG_ASYNC_RING_SIZE];
+  unsigned long _clog_async_head;
+  unsigned long _clog_async_tail;
+  unsigned long _clog_async_dropped;
+  pthread_t _clog_async_thread;
+  pthread_once_t _clog_async_once = PTHREAD_ONCE_INIT;
+
+  void* _clog_async_main(void* arg)
+  {
+    struct timespec idle;
+    idle.tv_sec = 0;
+    idle.tv_nsec = 1000000; /* 1 ms */
+    (void)arg;
+
+    for (;;) {
+      struct _clog_async_slot* slot =
+        &_clog_async_slots[_clog_async_tail & (CLOG_ASYNC_RING_SIZE - 1)];
+      if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) ==
+          _clog_async_tail + 1) {
+        _clog_emit(slot->sfile, slot->sline, slot->sfunction, slot->smodule,
+          slot->level, slot->text);
+        /* Mark the slot reusable one full lap from now. */
+        __atomic_store_n(&slot->seq,
+          _clog_async_tail + CLOG_ASYNC_RING_SIZE, __ATOMIC_RELEASE);
+        __atomic_store_n(&_clog_async_tail, _clog_async_tail + 1,
+          __ATOMIC_RELEASE);
+      }
+      else {
+        nanosleep(&idle, NULL);
+      }
+    }
+    return NULL;
+  }
+
+  void _clog_async_start(void)
+  {
+    unsigned long i;
+    for (i = 0; i < CLOG_ASYNC_RING_SIZE; ++i) {
+      _clog_async_slots[i].seq = i;
+    }
+    if (pthread_create(&_clog_async_thread, NULL, _clog_async_main, NULL)) {
+      _clog_err("Unable to start flusher thread: %s\n", strerror(errno));
+    }
+  }
+
+  void _clog_async_enqueue(const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level, const char* fmt,
+      va_list ap)
+  {
+    struct _clog_async_slot* slot;
+    unsigned long pos;
+    unsigned long seq;
+    long dif;
+
+    pthread_once(&_clog_async_once, _clog_async_start);
+
+    pos = __atomic_load_n(&_clog_async_head, __ATOMIC_RELAXED);
+    for (;;) {
+      slot = &_clog_async_slots[pos & (CLOG_ASYNC_RING_SIZE - 1)];
+      seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+      dif = (long)(seq - pos);
+      if (dif == 0) {
+        if (__atomic_compare_exchange_n(&_clog_async_head, &pos, pos + 1, 1,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+          break;
+        }
+      }
+      else if (dif < 0) {
+        /* Ring is full: drop rather than stall the caller. */
+        __atomic_fetch_add(&_clog_async_dropped, 1, __ATOMIC_RELAXED);
+        _CLOG_STAT_ADD(smodule->dropped, 1);
+        return;
+      }
+      else {
+        pos = __atomic_load_n(&_clog_async_head, __ATOMIC_RELAXED);
+      }
+    }
+
+    slot->sfile = sfile;
+    slot->sline = sline;
+    slot->sfunction = sfunction;
+    slot->smodule = smodule;
+    slot->level = level;
+    vsnprintf(slot->text, CLOG_ASYNC_MSG_LENGTH, fmt, ap);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+  }
+
+#endif /* CLOG_ASYNC */
+
+  void clog_flush(void)
+  {
+#ifdef CLOG_ASYNC
+    struct timespec idle;
+    idle.tv_sec = 0;
+    idle.tv_nsec = 1000000; /* 1 ms */
+
+    while (__atomic_load_n(&_clog_async_tail, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&_clog_async_head, __ATOMIC_ACQUIRE)) {
+      nanosleep(&idle, NULL);
+    }
+#endif /* CLOG_ASYNC */
+#ifdef CLOG_FILE_SUPPORT
+    if (_clog_logger.fd)
+    {
+      _CLOG_OUT_LOCK();
+      _clog_file_flush();
+#ifdef CLOG_DIRECT_SUPPORT
+      if (_clog_logger.dio_buf) {
+        _clog_dio_flush(&_clog_logger);
+      }
+#endif /* CLOG_DIRECT_SUPPORT */
+#ifdef CLOG_COMPRESS_SUPPORT
+      if (_clog_logger.z_in) {
+        _clog_z_flush(&_clog_logger);
+      }
+#endif /* CLOG_COMPRESS_SUPPORT */
+      _CLOG_OUT_UNLOCK();
+#ifdef CLOG_DIRECT_SUPPORT
+      if (_clog_logger.dio_buf && fdatasync(_clog_logger.fd) == -1) {
+        _clog_err("Unable to sync log file: %s\n", strerror(errno));
+      }
+#endif /* CLOG_DIRECT_SUPPORT */
+    }
+#ifdef CLOG_MMAP_SUPPORT
+    if (_clog_logger.map)
+    {
+      msync(_clog_logger.map, _clog_logger.map_off, MS_SYNC);
+    }
+#endif /* CLOG_MMAP_SUPPORT */
+#endif /* CLOG_FILE_SUPPORT */
+#ifdef CLOG_MULTI_SINK
+    {
+      int i;
+
+      _CLOG_OUT_LOCK();
+      for (i = 0; i < _clog_nsinks; ++i) {
+        _clog_sink_flush(&_clog_sinks[i]);
+      }
+      _CLOG_OUT_UNLOCK();
+    }
+#endif /* CLOG_MULTI_SINK */
+  }
+
+  /* True when at least one destination would take a message at this level.
+   * Checked before any formatting work so the no-consumer case (unit-test
+   * builds, after clog_close_file) costs a couple of loads instead of a
+   * vsnprintf plus a _clog_format pass that nobody reads. */
+  int _clog_has_consumer(enum clog_level level)
+  {
+    struct clog* logger = &_clog_logger;
+
+#ifdef CLOG_RING_SUPPORT
+    if (_clog_ring_active) {
+      return 1;
+    }
+#endif /* CLOG_RING_SUPPORT */
+#ifdef CLOG_FILE_SUPPORT
+    if (logger->fd) {
+      return 1;
+    }
+#endif /* CLOG_FILE_SUPPORT */
+#ifdef CLOG_SOCKET_SUPPORT
+    if (logger->sock) {
+      return 1;
+    }
+#endif /* CLOG_SOCKET_SUPPORT */
+    if (logger->fun) {
+      return 1;
+    }
+#ifdef CLOG_MULTI_SINK
+    {
+      int i;
+
+      for (i = 0; i < _clog_nsinks; ++i) {
+        if (level >= _clog_sinks[i].min_level) {
+          return 1;
+        }
+      }
+    }
+#else
+    (void)level;
+#endif /* CLOG_MULTI_SINK */
+    return 0;
+  }
+
+  void  _clog_log(const char* sfile, int sline, const char* sfunction, clog_control_block_t* smodule,
+      enum clog_level level, const char* fmt, ...)
+  {
+#ifdef CLOG_ASYNC
+    va_list ap;
+
+    if (!_clog_has_consumer(level)) {
+      return;
+    }
+#ifdef CLOG_RING_SUPPORT
+    /* An armed flight recorder takes every message, sink or no sink. */
+    if (_clog_ring_active) {
+      va_start(ap, fmt);
+      _clog_ring_capture(sfile, sline, sfunction, smodule, level, fmt, ap);
+      va_end(ap);
+      return;
+    }
+#endif /* CLOG_RING_SUPPORT */
+    va_start(ap, fmt);
+    _clog_async_enqueue(sfile, sline, sfunction, smodule, level, fmt, ap);
+    va_end(ap);
+#else /* CLOG_ASYNC */
+    /* For speed: Use a scratch buffer until message exceeds 4096, then switch
      * to dynamically allocated.  This should greatly reduce the number of
-     * memory allocations (and subsequent fragmentation). */
-    char buf[4096];
+     * memory allocations (and subsequent fragmentation).  With
+     * CLOG_THREAD_SAFE the scratch buffer is a per-thread arena. */
+    static CLOG_THREAD_LOCAL char buf[4096];
     size_t buf_size = 4096;
     char* dynbuf = buf;
-    char* message;
     va_list ap;
     int result;
-    struct clog* logger = &_clog_logger;
 
+    if (!_clog_has_consumer(level)) {
+      return;
+    }
+#ifdef CLOG_RING_SUPPORT
+    /* An armed flight recorder takes every message, sink or no sink. */
+    if (_clog_ring_active) {
+      va_start(ap, fmt);
+      _clog_ring_capture(sfile, sline, sfunction, smodule, level, fmt, ap);
+      va_end(ap);
+      return;
+    }
+#endif /* CLOG_RING_SUPPORT */
     /* Format the message text with the argument list. */
     va_start(ap, fmt);
     result = vsnprintf(dynbuf, buf_size, fmt, ap);
     if ((size_t)result >= buf_size) {
       buf_size = result + 1;
       dynbuf = (char*)malloc(buf_size);
+      /* The first vsnprintf consumed ap; it must be restarted before the
+       * second pass. */
+      va_end(ap);
+      va_start(ap, fmt);
       result = vsnprintf(dynbuf, buf_size, fmt, ap);
       if ((size_t)result >= buf_size) {
         /* Formatting failed -- too large */
@@ -517,40 +3652,295 @@ extern "C" {
     va_end(ap);
 
     /* Format according to log format and write to log */
-    {
-      char message_buf[4096];
-      message = _clog_format(logger, message_buf, 4096, sfile, sline, sfunction,
-        smodule, CLOG_LEVEL_NAMES[level], dynbuf);
-      if (!message) {
-        _clog_err("Formatting failed (2).\n");
-        if (dynbuf != buf) {
-          free(dynbuf);
-        }
+    _clog_emit(sfile, sline, sfunction, smodule, level, dynbuf);
+    if (dynbuf != buf) {
+      free(dynbuf);
+    }
+#endif /* CLOG_ASYNC */
+  }
+
+  /* Renders a whole buffer as a hexdump -C style block (offset column, hex
+   * pairs, ASCII gutter) in one pass with table lookups and hands it to the
+   * sink as a single message, so a dump costs one trip through the pipeline
+   * instead of one per byte and cannot interleave with other messages.
+   * Runs on the calling thread even with CLOG_ASYNC (a dump would not fit
+   * an async slot); an armed flight recorder does not capture dumps.  With
+   * CLOG_BINARY each dump line goes out as its own text record. */
+#ifdef CLOG_BINARY
+  void _clog_log_hexdump(unsigned short* site_id, const char* sfile,
+      int sline, const char* sfunction, clog_control_block_t* smodule,
+      enum clog_level level, const void* data, size_t len)
+#else
+  void _clog_log_hexdump(const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level,
+      const void* data, size_t len)
+#endif /* CLOG_BINARY */
+  {
+    static CLOG_THREAD_LOCAL char buf[4096];
+    const char* hexdig = "0123456789abcdef";
+    const unsigned char* bytes = (const unsigned char*)data;
+    char* text = buf;
+    char* p;
+    size_t need;
+    size_t off;
+    size_t n;
+    size_t i;
+    unsigned char c;
+
+    if (len == 0 || !_clog_has_consumer(level)) {
+      return;
+    }
+    /* 79 characters per 16-byte line, newline-separated. */
+    need = ((len + 15) / 16) * 80 + 1;
+    if (need > sizeof(buf)) {
+      text = (char*)malloc(need);
+      if (text == NULL) {
+        _clog_err("Formatting failed (3).\n");
         return;
       }
-
-#ifdef CLOG_FILE_SUPPORT
-      if (logger->fd)
-      {
-        result = POSIX_WRITE(logger->fd, message, strlen(message));
+    }
+    p = text;
+    for (off = 0; off < len; off += 16) {
+      n = len - off < 16 ? len - off : 16;
+      for (i = 0; i < 8; ++i) {
+        *p++ = hexdig[(off >> (28 - 4 * i)) & 0xf];
       }
-      else
-#endif        
-      if (logger->fun)
-      {
-        result = logger->fun(message);
+      *p++ = ' ';
+      *p++ = ' ';
+      for (i = 0; i < 16; ++i) {
+        if (i == 8) {
+          *p++ = ' ';
+        }
+        if (i < n) {
+          c = bytes[off + i];
+          *p++ = hexdig[c >> 4];
+          *p++ = hexdig[c & 0xf];
+        }
+        else {
+          /* Pad short final lines so the ASCII gutter stays aligned. */
+          *p++ = ' ';
+          *p++ = ' ';
+        }
+        *p++ = ' ';
+      }
+      *p++ = ' ';
+      *p++ = '|';
+      for (i = 0; i < n; ++i) {
+        c = bytes[off + i];
+        *p++ = (c >= 32 && c < 127) ? (char)c : '.';
+      }
+      *p++ = '|';
+      if (off + 16 < len) {
+        *p++ = '\n';
+      }
+    }
+    *p = 0;
+#ifdef CLOG_BINARY
+    {
+      /* The binary stream carries fixed-size records, so the block is
+       * split back into lines, one text record each. */
+      char* line = text;
+      char* nl;
+
+      for (;;) {
+        nl = strchr(line, '\n');
+        if (nl) {
+          *nl = 0;
+        }
+        _clog_log_bin(site_id, sfile, sline, sfunction, smodule, level,
+          "%s", line);
+        if (nl == NULL) {
+          break;
+        }
+        line = nl + 1;
       }
+    }
+#else
+    _clog_emit(sfile, sline, sfunction, smodule, level, text);
+#endif /* CLOG_BINARY */
+    if (text != buf) {
+      free(text);
+    }
+  }
 
-      if (result == -1) {
-        _clog_err("Unable to write to log file: %s\n", strerror(errno));
+  /* Appends s to the builder with JSON string escaping.  Clean runs are
+   * copied in one memcpy; only quote, backslash and control characters
+   * break the run. */
+  void _clog_append_json_str(struct _clog_builder* b, const char* s)
+  {
+    const char* hexdig = "0123456789abcdef";
+    const char* run = s;
+    char esc[6];
+    unsigned char c;
+
+    while (*s) {
+      c = (unsigned char)*s;
+      if (c == '"' || c == '\\' || c < 0x20) {
+        _clog_append_mem(b, run, (size_t)(s - run));
+        if (c == '"') {
+          _clog_append_mem(b, "\\\"", 2);
+        }
+        else if (c == '\\') {
+          _clog_append_mem(b, "\\\\", 2);
+        }
+        else if (c == '\n') {
+          _clog_append_mem(b, "\\n", 2);
+        }
+        else if (c == '\t') {
+          _clog_append_mem(b, "\\t", 2);
+        }
+        else if (c == '\r') {
+          _clog_append_mem(b, "\\r", 2);
+        }
+        else {
+          esc[0] = '\\';
+          esc[1] = 'u';
+          esc[2] = '0';
+          esc[3] = '0';
+          esc[4] = hexdig[c >> 4];
+          esc[5] = hexdig[c & 0xf];
+          _clog_append_mem(b, esc, 6);
+        }
+        run = s + 1;
       }
-      if (message != message_buf) {
-        free(message);
+      ++s;
+    }
+    _clog_append_mem(b, run, (size_t)(s - run));
+  }
+
+#ifdef CLOG_BINARY
+  void _clog_log_kv(unsigned short* site_id, const char* sfile, int sline,
+      const char* sfunction, clog_control_block_t* smodule,
+      enum clog_level level, const char* msg, ...)
+#else
+  void _clog_log_kv(const char* sfile, int sline, const char* sfunction,
+      clog_control_block_t* smodule, enum clog_level level,
+      const char* msg, ...)
+#endif /* CLOG_BINARY */
+  {
+    static CLOG_THREAD_LOCAL char buf[4096];
+    struct _clog_builder b;
+    char numbuf[32];
+    va_list ap;
+    const char* key;
+    int tag;
+    int stop = 0;
+
+    if (!_clog_has_consumer(level)) {
+      return;
+    }
+    _clog_builder_init(&b, buf, sizeof(buf));
+    _clog_append_mem(&b, "{", 1);
+#ifdef CLOG_TIME_SUPPORT
+    _clog_append_mem(&b, "\"ts\":", 5);
+    _clog_append_mem(&b, numbuf,
+      clog_fmt_u64(numbuf, (unsigned long long)time(NULL)));
+    _clog_append_mem(&b, ",", 1);
+#endif /* CLOG_TIME_SUPPORT */
+    _clog_append_mem(&b, "\"level\":\"", 9);
+    _clog_append_str(&b, CLOG_LEVEL_NAMES[level]);
+    _clog_append_mem(&b, "\",\"module\":\"", 12);
+    _clog_append_json_str(&b, smodule->module_name);
+    _clog_append_mem(&b, "\",\"file\":\"", 10);
+    _clog_append_json_str(&b, sfile);
+    _clog_append_mem(&b, "\",\"line\":", 9);
+    _clog_append_int(&b, sline);
+    _clog_append_mem(&b, ",\"func\":\"", 9);
+    _clog_append_json_str(&b, sfunction);
+    _clog_append_mem(&b, "\",\"msg\":\"", 9);
+    _clog_append_json_str(&b, msg);
+    _clog_append_mem(&b, "\"", 1);
+
+    va_start(ap, msg);
+    while (!stop) {
+      tag = va_arg(ap, int);
+      if (tag == (int)_CLOG_KV_END) {
+        break;
       }
-      if (dynbuf != buf) {
-        free(dynbuf);
+      key = va_arg(ap, const char*);
+      _clog_append_mem(&b, ",\"", 2);
+      _clog_append_json_str(&b, key);
+      _clog_append_mem(&b, "\":", 2);
+      switch (tag) {
+      case _CLOG_KV_U64:
+        _clog_append_mem(&b, numbuf,
+          clog_fmt_u64(numbuf, va_arg(ap, unsigned long long)));
+        break;
+      case _CLOG_KV_I64:
+        {
+          long long v = va_arg(ap, long long);
+
+          if (v < 0) {
+            /* -(v + 1) + 1 sidesteps the overflow of negating LLONG_MIN. */
+            _clog_append_mem(&b, "-", 1);
+            _clog_append_mem(&b, numbuf,
+              clog_fmt_u64(numbuf, (unsigned long long)-(v + 1) + 1));
+          }
+          else {
+            _clog_append_mem(&b, numbuf,
+              clog_fmt_u64(numbuf, (unsigned long long)v));
+          }
+        }
+        break;
+      case _CLOG_KV_F64:
+        {
+          /* The one conversion the integer formatters cannot replace. */
+          int n = snprintf(numbuf, sizeof(numbuf), "%.17g",
+            va_arg(ap, double));
+
+          if (n > 0 && (size_t)n < sizeof(numbuf)) {
+            _clog_append_mem(&b, numbuf, (size_t)n);
+          }
+          else {
+            _clog_append_mem(&b, "null", 4);
+          }
+        }
+        break;
+      case _CLOG_KV_STR:
+        {
+          const char* s = va_arg(ap, const char*);
+
+          if (s) {
+            _clog_append_mem(&b, "\"", 1);
+            _clog_append_json_str(&b, s);
+            _clog_append_mem(&b, "\"", 1);
+          }
+          else {
+            _clog_append_mem(&b, "null", 4);
+          }
+        }
+        break;
+      case _CLOG_KV_BOOL:
+        if (va_arg(ap, int)) {
+          _clog_append_mem(&b, "true", 4);
+        }
+        else {
+          _clog_append_mem(&b, "false", 5);
+        }
+        break;
+      default:
+        /* A tag the macros never produce means the list is unreadable
+         * from here on; emit what was collected so far. */
+        _clog_append_mem(&b, "null", 4);
+        stop = 1;
+        break;
       }
     }
+    va_end(ap);
+    _clog_append_mem(&b, "}\n", 2);
+
+#ifdef CLOG_BINARY
+    /* The binary stream stays binary: the JSON line rides in a text
+     * record, newline stripped, like the hexdump lines do. */
+    b.buf[b.len - 1] = 0;
+    _clog_log_bin(site_id, sfile, sline, sfunction, smodule, level,
+      "%s", b.buf);
+#else
+    _clog_deliver(smodule, level, b.buf, b.len);
+#endif /* CLOG_BINARY */
+    if (b.buf != b.orig) {
+      free(b.buf);
+    }
   }
 
   void  _clog_err(const char* fmt, ...)
@@ -567,7 +3957,7 @@ extern "C" {
   }
 
 #else /* CLOG_MAIN */
-  void  _clog_log(const char* sfile, int sline, const char* sfunction, const char* smodule,
+  void  _clog_log(const char* sfile, int sline, const char* sfunction, clog_control_block_t* smodule,
                    enum clog_level level, const char* fmt, ...);
 #endif /* CLOG_MAIN */
 
@@ -582,11 +3972,74 @@ extern "C" {
 *
 */
 #define clog_create_module(module, level) \
+clog_create_module_named(module, #module, level)
+
+/**
+* Create a new logger module whose display name differs from its C token,
+* e.g. clog_create_module_named(NET_TCP, "NET.TCP", LEVEL_INFO).  LOG_*
+* calls use the token; the name is what appears in messages and what
+* clog_set_level() patterns match against, so dotted hierarchies work even
+* though identifiers cannot contain dots.
+*
+* @param module
+* Module token used in LOG_* calls
+*
+* @param name
+* Module name string
+*
+* @param level
+* Debugmessage level
+*
+*/
+#define clog_create_module_named(module, name, level) \
 static clog_control_block_t clog_control_block_##module = \
 { \
-    #module, \
+    (name), \
     (level), \
-};
+    0, 0, 0, 0, 0, \
+}; \
+_CLOG_REGISTER_MODULE(module)
+
+/**
+* Evaluates to non-zero when the module's level would admit a message at
+* lvl - the exact test the LOG_* macros run, exposed as an expression.
+* The LOG_* families already guarantee that their argument expressions are
+* not evaluated when this test fails (the arguments sit inside the guarded
+* branch), so simple arguments need no wrapper; use this predicate to skip
+* whole blocks of expensive preparation work, in place of hand-rolled
+* "if (debug_enabled)" flags.  Valid anywhere after the module's
+* clog_create_module line in the same translation unit.
+*
+* @param module
+* Module name
+*
+* @param lvl
+* Level to test for (one of the LEVEL_* values).
+*
+*/
+#define CLOG_MODULE_ENABLED(module, lvl) \
+    (_CLOG_MODULE_LEVEL(clog_control_block_##module) <= (lvl))
+
+/* Hands an accepted message to the logger.  The basename of __FILE__ is
+ * resolved once per call site into a static (the strrchr scan used to run on
+ * every message); racing initialization under concurrency is benign since
+ * every thread computes the same pointer.  With CLOG_BINARY each call site
+ * additionally keeps a static registry ID and captures raw argument values
+ * instead of rendering text. */
+#ifdef CLOG_BINARY
+#define _CLOG_DISPATCH(module, lvl, ...) \
+    static unsigned short _clog_site = 0; \
+    static const char* _clog_sfile = NULL; \
+    _CLOG_STAT_ADD(clog_control_block_##module.emitted, 1); \
+    if (_clog_sfile == NULL) { _clog_sfile = _clog_basename(__FILE__); } \
+    _clog_log_bin(&_clog_site, _clog_sfile, __LINE__, __FUNCTION__, &clog_control_block_##module, (lvl), ##__VA_ARGS__);
+#else
+#define _CLOG_DISPATCH(module, lvl, ...) \
+    static const char* _clog_sfile = NULL; \
+    _CLOG_STAT_ADD(clog_control_block_##module.emitted, 1); \
+    if (_clog_sfile == NULL) { _clog_sfile = _clog_basename(__FILE__); } \
+    _clog_log(_clog_sfile, __LINE__, __FUNCTION__, &clog_control_block_##module, (lvl), ##__VA_ARGS__);
+#endif
 
 /**
 * Prints debugging message for the module
@@ -595,13 +4048,18 @@ static clog_control_block_t clog_control_block_##module = \
 * Module name
 *
 */
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG
 #define LOG_D(module, ...) \
 do { \
     extern clog_control_block_t clog_control_block_##module; \
     (void)(clog_control_block_##module); \
-    if(clog_control_block_##module.module_level <= LEVEL_DEBUG){\
-    _clog_log(__FILE__, __LINE__, __FUNCTION__, clog_control_block_##module.module_name, LEVEL_DEBUG, ##__VA_ARGS__);} \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_DEBUG){\
+    _CLOG_DISPATCH(module, LEVEL_DEBUG, ##__VA_ARGS__)} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
 } while (0)
+#else
+#define LOG_D(module, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG */
 
 /**
 * Prints information message for the module
@@ -610,13 +4068,18 @@ do { \
 * Module name
 *
 */
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO
 #define LOG_I(module, ...) \
 do { \
     extern clog_control_block_t clog_control_block_##module; \
     (void)(clog_control_block_##module); \
-    if(clog_control_block_##module.module_level <= LEVEL_INFO){\
-    _clog_log(__FILE__, __LINE__, __FUNCTION__, clog_control_block_##module.module_name, LEVEL_INFO, ##__VA_ARGS__);} \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_INFO){\
+    _CLOG_DISPATCH(module, LEVEL_INFO, ##__VA_ARGS__)} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
 } while (0)
+#else
+#define LOG_I(module, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO */
 
 /**
 * Prints warning message for the module
@@ -625,13 +4088,18 @@ do { \
 * Module name
 *
 */
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN
 #define LOG_W(module, ...) \
 do { \
     extern clog_control_block_t clog_control_block_##module; \
     (void)(clog_control_block_##module); \
-    if(clog_control_block_##module.module_level <= LEVEL_WARN){\
-    _clog_log(__FILE__, __LINE__, __FUNCTION__, clog_control_block_##module.module_name, LEVEL_WARN, ##__VA_ARGS__);} \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_WARN){\
+    _CLOG_DISPATCH(module, LEVEL_WARN, ##__VA_ARGS__)} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
 } while (0)
+#else
+#define LOG_W(module, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN */
 
 /**
 * Prints error message for the module
@@ -640,24 +4108,477 @@ do { \
 * Module name
 *
 */
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR
 #define LOG_E(module, ...) \
 do { \
     extern clog_control_block_t clog_control_block_##module; \
     (void)(clog_control_block_##module); \
-    if(clog_control_block_##module.module_level <= LEVEL_ERROR){\
-    _clog_log(__FILE__, __LINE__, __FUNCTION__, clog_control_block_##module.module_name, LEVEL_ERROR, ##__VA_ARGS__);} \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_ERROR){\
+    _CLOG_DISPATCH(module, LEVEL_ERROR, ##__VA_ARGS__)} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_E(module, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR */
+
+/**
+* Rate-limited variants of the LOG_* macros.  Each call site keeps its own
+* counter and emits at most max_per_sec messages per second; the rest are
+* dropped at the cost of a clock read and a compare.  When a site comes out
+* of suppression, a "last message repeated N times" summary is logged first
+* (skipped in CLOG_BINARY mode).  Use these for sites that can go
+* pathological, e.g. an error logged per failed request while a dependency
+* is down.
+*
+* @param module
+* Module name
+*
+* @param max_per_sec
+* Maximum number of messages this site may emit per second.
+*
+*/
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG
+#define LOG_D_RL(module, max_per_sec, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_DEBUG){\
+    static clog_ratelimit_t _clog_rl = { 0, 0, 0 }; \
+    if(_clog_rl_check(&_clog_rl, (max_per_sec), __FILE__, __LINE__, __FUNCTION__, &clog_control_block_##module, LEVEL_DEBUG)){\
+    _CLOG_DISPATCH(module, LEVEL_DEBUG, ##__VA_ARGS__)}} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_D_RL(module, max_per_sec, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO
+#define LOG_I_RL(module, max_per_sec, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_INFO){\
+    static clog_ratelimit_t _clog_rl = { 0, 0, 0 }; \
+    if(_clog_rl_check(&_clog_rl, (max_per_sec), __FILE__, __LINE__, __FUNCTION__, &clog_control_block_##module, LEVEL_INFO)){\
+    _CLOG_DISPATCH(module, LEVEL_INFO, ##__VA_ARGS__)}} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_I_RL(module, max_per_sec, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN
+#define LOG_W_RL(module, max_per_sec, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_WARN){\
+    static clog_ratelimit_t _clog_rl = { 0, 0, 0 }; \
+    if(_clog_rl_check(&_clog_rl, (max_per_sec), __FILE__, __LINE__, __FUNCTION__, &clog_control_block_##module, LEVEL_WARN)){\
+    _CLOG_DISPATCH(module, LEVEL_WARN, ##__VA_ARGS__)}} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_W_RL(module, max_per_sec, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR
+#define LOG_E_RL(module, max_per_sec, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_ERROR){\
+    static clog_ratelimit_t _clog_rl = { 0, 0, 0 }; \
+    if(_clog_rl_check(&_clog_rl, (max_per_sec), __FILE__, __LINE__, __FUNCTION__, &clog_control_block_##module, LEVEL_ERROR)){\
+    _CLOG_DISPATCH(module, LEVEL_ERROR, ##__VA_ARGS__)}} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_E_RL(module, max_per_sec, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR */
+
+/**
+* Sampled variants of the LOG_* macros.  Each call site keeps its own skip
+* counter and emits every Nth execution; the other N-1 cost one decrement
+* and a branch, with no clock read and no call into the logger.  Meant for
+* sites inside per-packet or per-iteration loops where full output is
+* unaffordable but a statistical sample still carries signal; for capping
+* a site by wall-clock rate instead, use LOG_*_RL.  The counter is not
+* atomic, so under concurrent callers the sampling rate is approximate -
+* which is the point of sampling.
+*
+* @param module
+* Module name
+*
+* @param every
+* Sampling period: one message is emitted per this many executions.  A
+* value of 1 emits everything.
+*
+*/
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG
+#define LOG_D_SAMPLED(module, every, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_DEBUG){\
+    static unsigned long _clog_skip = 0; \
+    if(_clog_skip == 0){ \
+    _clog_skip = (unsigned long)(every) - 1; \
+    _CLOG_DISPATCH(module, LEVEL_DEBUG, ##__VA_ARGS__)} \
+    else { --_clog_skip; _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); }} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_D_SAMPLED(module, every, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO
+#define LOG_I_SAMPLED(module, every, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_INFO){\
+    static unsigned long _clog_skip = 0; \
+    if(_clog_skip == 0){ \
+    _clog_skip = (unsigned long)(every) - 1; \
+    _CLOG_DISPATCH(module, LEVEL_INFO, ##__VA_ARGS__)} \
+    else { --_clog_skip; _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); }} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_I_SAMPLED(module, every, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN
+#define LOG_W_SAMPLED(module, every, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_WARN){\
+    static unsigned long _clog_skip = 0; \
+    if(_clog_skip == 0){ \
+    _clog_skip = (unsigned long)(every) - 1; \
+    _CLOG_DISPATCH(module, LEVEL_WARN, ##__VA_ARGS__)} \
+    else { --_clog_skip; _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); }} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_W_SAMPLED(module, every, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR
+#define LOG_E_SAMPLED(module, every, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_ERROR){\
+    static unsigned long _clog_skip = 0; \
+    if(_clog_skip == 0){ \
+    _clog_skip = (unsigned long)(every) - 1; \
+    _CLOG_DISPATCH(module, LEVEL_ERROR, ##__VA_ARGS__)} \
+    else { --_clog_skip; _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); }} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_E_SAMPLED(module, every, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR */
+
+/**
+* Dumps a memory buffer for the module as a hexdump -C style block: offset
+* column, hex pairs and an ASCII gutter, 16 bytes per line.  The whole
+* buffer is rendered in one pass and delivered as a single multi-line
+* message, so a 1KB dump costs one trip through the pipeline instead of a
+* LOG_D per byte, and concurrent messages cannot interleave with it.  The
+* level is a runtime argument, so CLOG_COMPILE_LEVEL does not elide these
+* sites unless logging is compiled out entirely.
+*
+* @param module
+* Module name
+*
+* @param lvl
+* Level to log the dump at (one of the LEVEL_* values).
+*
+* @param ptr
+* Start of the buffer to dump.
+*
+* @param length
+* Number of bytes to dump; zero dumps nothing.
+*
+*/
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR
+#ifdef CLOG_BINARY
+#define LOG_HEXDUMP(module, lvl, ptr, length) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= (lvl)){\
+    static unsigned short _clog_site = 0; \
+    static const char* _clog_sfile = NULL; \
+    _CLOG_STAT_ADD(clog_control_block_##module.emitted, 1); \
+    if (_clog_sfile == NULL) { _clog_sfile = _clog_basename(__FILE__); } \
+    _clog_log_hexdump(&_clog_site, _clog_sfile, __LINE__, __FUNCTION__, &clog_control_block_##module, (lvl), (ptr), (length));} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_HEXDUMP(module, lvl, ptr, length) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= (lvl)){\
+    static const char* _clog_sfile = NULL; \
+    _CLOG_STAT_ADD(clog_control_block_##module.emitted, 1); \
+    if (_clog_sfile == NULL) { _clog_sfile = _clog_basename(__FILE__); } \
+    _clog_log_hexdump(_clog_sfile, __LINE__, __FUNCTION__, &clog_control_block_##module, (lvl), (ptr), (length));} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#endif /* CLOG_BINARY */
+#else
+#define LOG_HEXDUMP(module, lvl, ptr, length) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR */
+
+/**
+* Lazy-argument variants of the LOG_* macros.  The function fn is called
+* with ctx only when the module level admits the message, and its return
+* value is logged as the message text - so serializers, getters that take
+* locks and other expensive argument builders are provably skipped while
+* the site is filtered.  (Plain LOG_* arguments are also unevaluated when
+* filtered; this form exists for cases where the expensive work does not
+* fit naturally into an argument expression.)
+*
+* @param module
+* Module name
+*
+* @param fn
+* Function with the signature const char* fn(void* ctx), returning the
+* message text.  The returned string is consumed before the macro
+* returns and may live in a temporary buffer.
+*
+* @param ctx
+* Opaque pointer handed through to fn.
+*
+*/
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG
+#define LOG_D_LAZY(module, fn, ctx) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_DEBUG){\
+    _CLOG_DISPATCH(module, LEVEL_DEBUG, "%s", (fn)(ctx))} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_D_LAZY(module, fn, ctx) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO
+#define LOG_I_LAZY(module, fn, ctx) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_INFO){\
+    _CLOG_DISPATCH(module, LEVEL_INFO, "%s", (fn)(ctx))} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_I_LAZY(module, fn, ctx) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN
+#define LOG_W_LAZY(module, fn, ctx) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_WARN){\
+    _CLOG_DISPATCH(module, LEVEL_WARN, "%s", (fn)(ctx))} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_W_LAZY(module, fn, ctx) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR
+#define LOG_E_LAZY(module, fn, ctx) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_ERROR){\
+    _CLOG_DISPATCH(module, LEVEL_ERROR, "%s", (fn)(ctx))} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_E_LAZY(module, fn, ctx) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR */
+
+/**
+* Structured key-value variants of the LOG_* macros.  Fields are typed at
+* the call site and encoded straight to a JSON line, with no printf-style
+* format parsing in between:
+*
+*   LOG_I_KV(NET, "request done",
+*     CLOG_U64("bytes", nbytes), CLOG_STR("peer", addr));
+*
+* gives one line of the form
+*
+*   {"ts":..,"level":"I","module":"NET","file":..,"line":..,"func":..,
+*    "msg":"request done","bytes":1234,"peer":"10.0.0.7"}
+*
+* The "level" field carries the same single-letter names (D/I/W/E) that
+* the formatted output uses.
+*
+* The line is built with the integer formatters into a thread-local buffer
+* (heap only past 4KB) and handed to the configured sink as-is, bypassing
+* the message format - set with clog_set_format() - entirely; the "ts"
+* field (epoch seconds) appears only with CLOG_TIME_SUPPORT.  Floating
+* point fields are the one case that still goes through snprintf.  Message,
+* keys and string values are JSON-escaped; keys are emitted in call order
+* and not deduplicated.  With CLOG_BINARY the JSON line is shipped as a
+* text record so the stream stays decodable.
+*
+* @param module
+* Module name
+*
+* @param msg
+* Message text, stored in the "msg" field.
+*
+* @param ...
+* Zero or more fields, each written as one of the macros below:
+* CLOG_U64(key, value), CLOG_I64(key, value), CLOG_F64(key, value),
+* CLOG_STR(key, value) (NULL becomes a JSON null) or
+* CLOG_BOOL(key, value).  Keys are string literals or C strings.
+*
+*/
+#define CLOG_U64(key, value) (int)_CLOG_KV_U64, (key), (unsigned long long)(value)
+#define CLOG_I64(key, value) (int)_CLOG_KV_I64, (key), (long long)(value)
+#define CLOG_F64(key, value) (int)_CLOG_KV_F64, (key), (double)(value)
+#define CLOG_STR(key, value) (int)_CLOG_KV_STR, (key), (const char*)(value)
+#define CLOG_BOOL(key, value) (int)_CLOG_KV_BOOL, (key), (int)((value) != 0)
+
+#ifdef CLOG_BINARY
+#define _CLOG_KV_DISPATCH(module, lvl, msg, ...) \
+    static unsigned short _clog_site = 0; \
+    static const char* _clog_sfile = NULL; \
+    _CLOG_STAT_ADD(clog_control_block_##module.emitted, 1); \
+    if (_clog_sfile == NULL) { _clog_sfile = _clog_basename(__FILE__); } \
+    _clog_log_kv(&_clog_site, _clog_sfile, __LINE__, __FUNCTION__, &clog_control_block_##module, (lvl), (msg), ##__VA_ARGS__, (int)_CLOG_KV_END);
+#else
+#define _CLOG_KV_DISPATCH(module, lvl, msg, ...) \
+    static const char* _clog_sfile = NULL; \
+    _CLOG_STAT_ADD(clog_control_block_##module.emitted, 1); \
+    if (_clog_sfile == NULL) { _clog_sfile = _clog_basename(__FILE__); } \
+    _clog_log_kv(_clog_sfile, __LINE__, __FUNCTION__, &clog_control_block_##module, (lvl), (msg), ##__VA_ARGS__, (int)_CLOG_KV_END);
+#endif /* CLOG_BINARY */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG
+#define LOG_D_KV(module, msg, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_DEBUG){\
+    _CLOG_KV_DISPATCH(module, LEVEL_DEBUG, (msg), ##__VA_ARGS__)} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_D_KV(module, msg, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_DEBUG */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO
+#define LOG_I_KV(module, msg, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_INFO){\
+    _CLOG_KV_DISPATCH(module, LEVEL_INFO, (msg), ##__VA_ARGS__)} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_I_KV(module, msg, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_INFO */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN
+#define LOG_W_KV(module, msg, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_WARN){\
+    _CLOG_KV_DISPATCH(module, LEVEL_WARN, (msg), ##__VA_ARGS__)} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
+} while (0)
+#else
+#define LOG_W_KV(module, msg, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_WARN */
+
+#if CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR
+#define LOG_E_KV(module, msg, ...) \
+do { \
+    extern clog_control_block_t clog_control_block_##module; \
+    (void)(clog_control_block_##module); \
+    if(_CLOG_MODULE_LEVEL(clog_control_block_##module) <= LEVEL_ERROR){\
+    _CLOG_KV_DISPATCH(module, LEVEL_ERROR, (msg), ##__VA_ARGS__)} \
+    else { _CLOG_STAT_ADD(clog_control_block_##module.suppressed, 1); } \
 } while (0)
+#else
+#define LOG_E_KV(module, msg, ...) do { } while (0)
+#endif /* CLOG_COMPILE_LEVEL <= CLOG_LEVEL_ERROR */
 
 #else
 
 #define clog_init_file(path)
+#define clog_init_file_buffered(path, bufsize, flush_interval_ms)
+#define clog_init_file_shared(path, bufsize, flush_interval_ms)
+#define clog_init_file_mmap(path, initial_size)
+#define clog_init_file_rotating(path, max_bytes, max_files)
+#define clog_init_file_direct(path, block_bytes, bufblocks)
+#define clog_set_sync_policy(every_bytes, every_ms, on_error)
+#define clog_init_file_compressed(path)
 #define clog_close_file()
+#define clog_flush()
 #define clog_init_console(fun)
+#define clog_set_format(fmt)
+#define clog_set_module_level(name, level)
+#define clog_set_all_levels(level)
+#define clog_set_level(pattern, level)
+#define clog_create_module_named(module, name, level)
+#define clog_get_stats(name)
+#define clog_log_stats()
+#define clog_init_ring()
+#define clog_dump_ring(fd)
+#define clog_add_sink_fd(fd, min_level, bufsize, flush_interval_ms)
+#define clog_add_sink_file(path, min_level, bufsize, flush_interval_ms)
+#define clog_add_sink_console(fun, min_level)
+#define clog_close_sinks()
+#define clog_fmt_u64(dst, v)
+#define clog_fmt_hex(dst, v)
+#define clog_init_socket(host, port)
+#define clog_close_socket()
+#define clog_socket_dropped()
 #define clog_create_module(module, level)
 #define LOG_D(module, ...)
 #define LOG_I(module, ...)
 #define LOG_W(module, ...)
 #define LOG_E(module, ...)
+#define LOG_D_RL(module, max_per_sec, ...)
+#define LOG_I_RL(module, max_per_sec, ...)
+#define LOG_W_RL(module, max_per_sec, ...)
+#define LOG_E_RL(module, max_per_sec, ...)
+#define LOG_D_SAMPLED(module, every, ...)
+#define LOG_I_SAMPLED(module, every, ...)
+#define LOG_W_SAMPLED(module, every, ...)
+#define LOG_E_SAMPLED(module, every, ...)
+#define LOG_HEXDUMP(module, lvl, ptr, length)
+#define LOG_D_LAZY(module, fn, ctx)
+#define LOG_I_LAZY(module, fn, ctx)
+#define LOG_W_LAZY(module, fn, ctx)
+#define LOG_E_LAZY(module, fn, ctx)
+#define LOG_D_KV(module, msg, ...)
+#define LOG_I_KV(module, msg, ...)
+#define LOG_W_KV(module, msg, ...)
+#define LOG_E_KV(module, msg, ...)
+#define CLOG_U64(key, value)
+#define CLOG_I64(key, value)
+#define CLOG_F64(key, value)
+#define CLOG_STR(key, value)
+#define CLOG_BOOL(key, value)
+#define CLOG_MODULE_ENABLED(module, lvl) (0)
 
 #endif /* CLOG_DISABLED */
 
@@ -0,0 +1,267 @@
+/* clog-decode: renders a CLOG_BINARY record stream back into text.
+ *
+ * Usage:
+ *   clog-decode [logfile]
+ *
+ * Reads the binary log from the given file (or stdin) and prints one text
+ * line per message to stdout, in the form
+ *
+ *   2024-10-29 18:29:29 I: MY_MODULE: main.c(175): main: the message
+ *
+ * The stream must come from a host with the same endianness.  See the
+ * CLOG_BINARY section in clog.h for the record layout.
+ *
+ * Build:
+ *   gcc -O2 -I.. -o clog-decode clog_decode.c
+ */
+
+#define CLOG_FILE_SUPPORT
+#define CLOG_BINARY
+#include "clog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Site IDs are 16-bit, so a flat table covers all of them. */
+struct site {
+  char* file;
+  char* function;
+  char* module;
+  char* fmt;
+  unsigned int line;
+};
+
+static struct site sites[65536];
+
+static const char* const level_names[] = { "D", "I", "W", "E" };
+
+static void bad_stream(const char* what)
+{
+  fprintf(stderr, "clog-decode: malformed stream (%s)\n", what);
+  exit(1);
+}
+
+/* Pulls the next NUL-terminated string out of the payload. */
+static char* take_str(unsigned char** p, unsigned char* end)
+{
+  char* s = (char*)*p;
+  unsigned char* nul = memchr(*p, 0, (size_t)(end - *p));
+
+  if (nul == NULL) {
+    bad_stream("unterminated string");
+  }
+  *p = nul + 1;
+  return s;
+}
+
+static void decode_site(unsigned short id, unsigned char* p,
+    unsigned char* end)
+{
+  struct site* s = &sites[id];
+
+  if ((size_t)(end - p) < 4) {
+    bad_stream("short site record");
+  }
+  memcpy(&s->line, p, 4);
+  p += 4;
+  free(s->file);
+  s->file = strdup(take_str(&p, end));
+  free(s->function);
+  s->function = strdup(take_str(&p, end));
+  free(s->module);
+  s->module = strdup(take_str(&p, end));
+  free(s->fmt);
+  s->fmt = strdup(take_str(&p, end));
+}
+
+static void print_prefix(const struct site* s, unsigned char level,
+    unsigned long long sec)
+{
+  char stamp[64];
+  time_t t = (time_t)sec;
+  struct tm* lt = localtime(&t);
+
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", lt);
+  printf("%s %s: %s: %s(%u): %s: ", stamp,
+    level < 4 ? level_names[level] : "?",
+    s->module, s->file, s->line, s->function);
+}
+
+/* Re-renders one message from its site's format string and the tagged
+ * argument values in the payload.  The conversion spec from the original
+ * format is reused, with the length modifier normalized to what the decoder
+ * actually holds (long long for integers, double for floats). */
+static void render_message(const struct site* s, unsigned char* p,
+    unsigned char* end)
+{
+  const char* f = s->fmt;
+  char spec[64];
+  char strbuf[CLOG_BIN_STR_MAX + 1];
+  size_t n;
+
+  while (*f) {
+    if (*f != '%') {
+      putchar(*f++);
+      continue;
+    }
+    ++f;
+    if (*f == '%') {
+      putchar('%');
+      ++f;
+      continue;
+    }
+    /* Copy flags, width and precision into the rebuilt spec. */
+    n = 0;
+    spec[n++] = '%';
+    while (*f == '-' || *f == '+' || *f == ' ' || *f == '#' || *f == '0' ||
+           (*f >= '0' && *f <= '9') || *f == '.') {
+      if (n < sizeof(spec) - 8) {
+        spec[n++] = *f;
+      }
+      ++f;
+    }
+    /* Skip the original length modifier; the tag decides the real one. */
+    while (*f == 'h' || *f == 'l' || *f == 'z' || *f == 't' || *f == 'j' ||
+           *f == 'L') {
+      ++f;
+    }
+    if (*f == 0 || p >= end) {
+      bad_stream("format/argument mismatch");
+    }
+    switch (*p++) {
+    case CLOG_BIN_ARG_INT: {
+      unsigned long long v;
+      if ((size_t)(end - p) < 8) {
+        bad_stream("short int argument");
+      }
+      memcpy(&v, p, 8);
+      p += 8;
+      if (*f == 'c') {
+        spec[n++] = 'c';
+        spec[n] = 0;
+        printf(spec, (int)v);
+      }
+      else {
+        spec[n++] = 'l';
+        spec[n++] = 'l';
+        spec[n++] = (*f == 'i') ? 'd' : *f;
+        spec[n] = 0;
+        printf(spec, v);
+      }
+      break;
+    }
+    case CLOG_BIN_ARG_DBL: {
+      double v;
+      if ((size_t)(end - p) < 8) {
+        bad_stream("short double argument");
+      }
+      memcpy(&v, p, 8);
+      p += 8;
+      spec[n++] = *f;
+      spec[n] = 0;
+      printf(spec, v);
+      break;
+    }
+    case CLOG_BIN_ARG_STR: {
+      unsigned int len;
+      if ((size_t)(end - p) < 4) {
+        bad_stream("short string argument");
+      }
+      memcpy(&len, p, 4);
+      p += 4;
+      if (len > CLOG_BIN_STR_MAX || (size_t)(end - p) < len) {
+        bad_stream("string argument length");
+      }
+      memcpy(strbuf, p, len);
+      strbuf[len] = 0;
+      p += len;
+      spec[n++] = 's';
+      spec[n] = 0;
+      printf(spec, strbuf);
+      break;
+    }
+    case CLOG_BIN_ARG_PTR: {
+      unsigned long long v;
+      if ((size_t)(end - p) < 8) {
+        bad_stream("short pointer argument");
+      }
+      memcpy(&v, p, 8);
+      p += 8;
+      printf("0x%llx", v);
+      break;
+    }
+    default:
+      bad_stream("unknown argument tag");
+    }
+    ++f;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  FILE* in = stdin;
+  unsigned char hdr[8];
+  unsigned char* payload;
+  unsigned char type;
+  unsigned char level;
+  unsigned short site;
+  unsigned int len;
+  unsigned long long sec;
+
+  if (argc > 1) {
+    in = fopen(argv[1], "rb");
+    if (in == NULL) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+
+  while (fread(hdr, 1, 8, in) == 8) {
+    type = hdr[0];
+    level = hdr[1];
+    memcpy(&site, hdr + 2, 2);
+    memcpy(&len, hdr + 4, 4);
+    if (len > CLOG_BIN_RECORD_LENGTH) {
+      bad_stream("oversized record");
+    }
+    payload = malloc(len ? len : 1);
+    if (payload == NULL || fread(payload, 1, len, in) != len) {
+      bad_stream("truncated record");
+    }
+
+    switch (type) {
+    case CLOG_BIN_SITE:
+      decode_site(site, payload, payload + len);
+      break;
+    case CLOG_BIN_MSG:
+    case CLOG_BIN_TEXT:
+      if (sites[site].fmt == NULL) {
+        bad_stream("message for unknown site");
+      }
+      if (len < 16) {
+        bad_stream("short message record");
+      }
+      memcpy(&sec, payload, 8);
+      print_prefix(&sites[site], level, sec);
+      if (type == CLOG_BIN_MSG) {
+        render_message(&sites[site], payload + 16, payload + len);
+      }
+      else {
+        fwrite(payload + 16, 1, strnlen((char*)payload + 16, len - 16),
+          stdout);
+      }
+      putchar('\n');
+      break;
+    default:
+      bad_stream("unknown record type");
+    }
+    free(payload);
+  }
+
+  if (in != stdin) {
+    fclose(in);
+  }
+  return 0;
+}